@@ -0,0 +1,286 @@
+/*
+ * CRC32C (Castagnoli) of the out-of-band area of every NAND page.
+ * crc32c_init() picks AVX-512 carry-less multiplies when the CPU has
+ * them, else the SSE4.2 crc32 instruction, else a table-driven version.
+ * crc32c(0, buf, len) starts a checksum, passing the previous result
+ * continues it.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define CRC32C_POLY (0x82F63B78)
+
+// The SSE4.2 version runs three lanes of this many bytes side by side
+#define CRC32C_LANE (168)
+
+// The VPCLMULQDQ version folds this many bytes at a time
+#define CRC32C_FOLD (256)
+
+// crc32c_table[k] advances the CRC over a byte followed by k zero bytes
+static uint32_t crc32c_table[8][256];
+// crc32c_shift advances the CRC over CRC32C_LANE zero bytes, a byte at a time
+static uint32_t crc32c_shift[4][256];
+// crc32c_fold_k[n] moves a 16-byte chunk forward over n chunks
+static uint64_t crc32c_fold_k[CRC32C_FOLD / 16 + 1][2];
+
+static uint64_t crc32c_load(const unsigned char* p)
+{
+    uint64_t word;
+
+    memcpy(&word, p, 8);
+    return word;
+}
+
+/*
+ * Slicing-by-8, eight table lookups per 8 bytes
+ */
+static uint32_t crc32c_sw(uint32_t crc, const void* buf, size_t len)
+{
+    const unsigned char* p = buf;
+
+    crc = ~crc;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8)
+    {
+        uint64_t word = crc32c_load(p) ^ crc;
+
+        crc = crc32c_table[7][word & 0xFF] ^
+              crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^
+              crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^
+              crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^
+              crc32c_table[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+    while (len--)
+    {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(__x86_64__)
+static uint32_t crc32c_lane_shift(uint32_t crc)
+{
+    return crc32c_shift[0][crc & 0xFF] ^ crc32c_shift[1][(crc >> 8) & 0xFF] ^
+           crc32c_shift[2][(crc >> 16) & 0xFF] ^ crc32c_shift[3][crc >> 24];
+}
+
+/*
+ * crc32 has a latency of three cycles but issues every cycle, so three
+ * lanes are checksummed at once, the last two starting from 0. Shifting
+ * the CRC of a lane over the next lane and xoring them joins the lanes.
+ * crc32c_fold() inlines it for its tail, a call would run it as legacy
+ * SSE code right after the AVX-512 part.
+ */
+static inline __attribute__((always_inline, target("sse4.2")))
+uint32_t crc32c_hw_pass(uint32_t crc, const unsigned char* p, size_t len)
+{
+    uint64_t crc64;
+
+    crc64 = (uint32_t)~crc;
+    while (len >= 3 * CRC32C_LANE)
+    {
+        uint64_t crc1 = 0, crc2 = 0;
+
+        for (int i = 0; i < CRC32C_LANE; i += 8)
+        {
+            crc64 = _mm_crc32_u64(crc64, crc32c_load(&p[i]));
+            crc1 = _mm_crc32_u64(crc1, crc32c_load(&p[CRC32C_LANE + i]));
+            crc2 = _mm_crc32_u64(crc2, crc32c_load(&p[2 * CRC32C_LANE + i]));
+        }
+        crc64 = crc32c_lane_shift(crc32c_lane_shift(crc64) ^ crc1) ^ crc2;
+        p += 3 * CRC32C_LANE;
+        len -= 3 * CRC32C_LANE;
+    }
+    while (len >= 8)
+    {
+        crc64 = _mm_crc32_u64(crc64, crc32c_load(p));
+        p += 8;
+        len -= 8;
+    }
+    crc = crc64;
+    while (len--)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return ~crc;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void* buf, size_t len)
+{
+    return crc32c_hw_pass(crc, buf, len);
+}
+
+#define CRC32C_FOLD_TARGET "sse4.2,pclmul,avx512f,vpclmulqdq"
+
+// Constant of crc32c_fold_k[n] in each 16-byte lane
+__attribute__((target(CRC32C_FOLD_TARGET)))
+static __m512i crc32c_fold_bcast(int n)
+{
+    return _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*)crc32c_fold_k[n]));
+}
+
+// Move every lane of x forward by the distance of k, add data
+__attribute__((target(CRC32C_FOLD_TARGET)))
+static inline __m512i crc32c_fold512(__m512i x, __m512i k, __m512i data)
+{
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00),
+                                     _mm512_clmulepi64_epi128(x, k, 0x11), data, 0x96);
+}
+
+/*
+ * Carry-less multiplication folds the data into four 64-byte blocks,
+ * 256 bytes per round, then the blocks into one 16-byte chunk. A
+ * chunk times x^n is congruent to the chunk n bits further on, so the
+ * CRC of the chunk is that of the data so far. The crc32 instruction
+ * finishes it and takes the tail.
+ */
+__attribute__((target(CRC32C_FOLD_TARGET)))
+static uint32_t crc32c_fold(uint32_t crc, const void* buf, size_t len)
+{
+    const unsigned char* p = buf;
+    __m512i x0, x1, x2, x3, k;
+    __m128i r;
+    uint64_t crc64;
+
+    if (len < CRC32C_FOLD)
+    {
+        return crc32c_hw_pass(crc, p, len);
+    }
+
+    x0 = _mm512_loadu_si512(p);
+    x1 = _mm512_loadu_si512(p + 64);
+    x2 = _mm512_loadu_si512(p + 128);
+    x3 = _mm512_loadu_si512(p + 192);
+    x0 = _mm512_xor_si512(x0, _mm512_set_epi64(0, 0, 0, 0, 0, 0, 0, (uint32_t)~crc));
+    p += CRC32C_FOLD;
+    len -= CRC32C_FOLD;
+
+    k = crc32c_fold_bcast(16);
+    while (len >= CRC32C_FOLD)
+    {
+        x0 = crc32c_fold512(x0, k, _mm512_loadu_si512(p));
+        x1 = crc32c_fold512(x1, k, _mm512_loadu_si512(p + 64));
+        x2 = crc32c_fold512(x2, k, _mm512_loadu_si512(p + 128));
+        x3 = crc32c_fold512(x3, k, _mm512_loadu_si512(p + 192));
+        p += CRC32C_FOLD;
+        len -= CRC32C_FOLD;
+    }
+
+    x3 = crc32c_fold512(x0, crc32c_fold_bcast(12), x3);
+    x3 = crc32c_fold512(x1, crc32c_fold_bcast(8), x3);
+    x3 = crc32c_fold512(x2, crc32c_fold_bcast(4), x3);
+
+    k = crc32c_fold_bcast(4);
+    while (len >= 64)
+    {
+        x3 = crc32c_fold512(x3, k, _mm512_loadu_si512(p));
+        p += 64;
+        len -= 64;
+    }
+
+    // Lane i moves forward over the 3 - i lanes after it
+    k = _mm512_set_epi64(0, 0, crc32c_fold_k[1][1], crc32c_fold_k[1][0],
+                         crc32c_fold_k[2][1], crc32c_fold_k[2][0],
+                         crc32c_fold_k[3][1], crc32c_fold_k[3][0]);
+    x3 = crc32c_fold512(x3, k, _mm512_maskz_mov_epi64(0xC0, x3));
+    r = _mm_xor_si128(_mm_xor_si128(_mm512_extracti32x4_epi32(x3, 0),
+                                    _mm512_extracti32x4_epi32(x3, 1)),
+                      _mm_xor_si128(_mm512_extracti32x4_epi32(x3, 2),
+                                    _mm512_extracti32x4_epi32(x3, 3)));
+
+    while (len >= 16)
+    {
+        __m128i k1 = _mm_loadu_si128((const __m128i*)crc32c_fold_k[1]);
+        __m128i data = _mm_loadu_si128((const __m128i*)p);
+
+        r = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(r, k1, 0x00),
+                                        _mm_clmulepi64_si128(r, k1, 0x11)), data);
+        p += 16;
+        len -= 16;
+    }
+
+    crc64 = _mm_crc32_u64(0, _mm_cvtsi128_si64(r));
+    crc64 = _mm_crc32_u64(crc64, _mm_extract_epi64(r, 1));
+    return crc32c_hw_pass(~(uint32_t)crc64, p, len);
+}
+#endif
+
+static uint32_t (*crc32c)(uint32_t crc, const void* buf, size_t len) = crc32c_sw;
+
+/*
+ * Fill the tables and pick the fastest version, return its name
+ */
+static const char* crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc32c_table[0][i] = crc;
+    }
+    for (int k = 1; k < 8; k++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            uint32_t crc = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+        }
+    }
+    for (int k = 0; k < 4; k++)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i << (8 * k);
+            for (int n = 0; n < CRC32C_LANE; n++)
+            {
+                crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+            }
+            crc32c_shift[k][i] = crc;
+        }
+    }
+
+    // x^(128n + 63) and x^(128n - 1) mod P, in the top half of a carry-less operand
+    for (int n = 1; n <= CRC32C_FOLD / 16; n++)
+    {
+        uint32_t crc = 0x80000000;
+        for (int bit = 0; bit < 128 * n + 63; bit++)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            if (bit == 128 * n - 2)
+            {
+                crc32c_fold_k[n][1] = (uint64_t)crc << 32;
+            }
+        }
+        crc32c_fold_k[n][0] = (uint64_t)crc << 32;
+    }
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq") &&
+        __builtin_cpu_supports("pclmul"))
+    {
+        crc32c = crc32c_fold;
+        return "avx512 vpclmulqdq";
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        crc32c = crc32c_hw;
+        return "sse4.2";
+    }
+#endif
+    crc32c = crc32c_sw;
+    return "table";
+}
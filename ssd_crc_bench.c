@@ -0,0 +1,116 @@
+/*
+  Microbenchmark of the CRC32C kernels guarding every NAND page,
+  against page size. The cost of one checksum is compared with one
+  program plus one read of the same size on a NAND backing file.
+*/
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "ssd_fuse_header.h"
+#include "ssd_crc32c.h"
+
+#define BENCH_BYTES (256UL * 1024 * 1024)
+#define IO_BYTES    (16UL * 1024 * 1024)
+
+typedef uint32_t (*CRC_FN)(uint32_t crc, const void* buf, size_t len);
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Nanoseconds per checksum of size bytes
+static double bench_crc(CRC_FN fn, const char* buf, size_t size, size_t bytes)
+{
+    volatile uint32_t sink = 0;
+    size_t loops = bytes / size;
+    double start;
+
+    start = now_ns();
+    for (size_t i = 0; i < loops; i++)
+    {
+        sink = fn(sink, buf, size);
+    }
+    return (now_ns() - start) / loops;
+}
+
+// Nanoseconds per pwrite plus pread of size bytes
+static double bench_io(int fd, char* buf, size_t size)
+{
+    size_t loops = IO_BYTES / size;
+    double start;
+
+    start = now_ns();
+    for (size_t i = 0; i < loops; i++)
+    {
+        if (pwrite(fd, buf, size, 0) != size || pread(fd, buf, size, 0) != size)
+        {
+            perror("io");
+            exit(1);
+        }
+    }
+    return (now_ns() - start) / loops;
+}
+
+int main(int argc, char** argv)
+{
+    char path[100];
+    const char* impl;
+    char* buf;
+    int fd;
+
+    buf = malloc(65536);
+    for (int i = 0; i < 65536; i++)
+    {
+        buf[i] = rand();
+    }
+
+    // Both versions must agree with the check value and with each other
+    impl = crc32c_init();
+    if (crc32c_sw(0, "123456789", 9) != 0xE3069283 ||
+        crc32c(0, "123456789", 9) != 0xE3069283)
+    {
+        printf("crc32c self test fail\n");
+        return 1;
+    }
+    for (size_t size = 0; size <= 4096; size++)
+    {
+        if (crc32c(size, &buf[size % 8], size) != crc32c_sw(size, &buf[size % 8], size))
+        {
+            printf("crc32c self test fail, size %zu\n", size);
+            return 1;
+        }
+    }
+
+    snprintf(path, 100, "%s/crc_bench", NAND_LOCATION);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("open");
+        return 1;
+    }
+
+    printf("crc32c: %s\n", impl);
+    printf("%8s %10s %10s %10s %10s %10s %8s\n", "size", "table ns", "table GB/s",
+           "crc ns", "crc GB/s", "io ns", "overhead");
+    for (size_t size = 512; size <= 65536; size *= 2)
+    {
+        double sw, hw, io;
+
+        sw = bench_crc(crc32c_sw, buf, size, BENCH_BYTES / 8);
+        hw = bench_crc(crc32c, buf, size, BENCH_BYTES);
+        io = bench_io(fd, buf, size);
+        printf("%8zu %10.1f %10.2f %10.1f %10.2f %10.1f %7.2f%%\n", size,
+               sw, size / sw, hw, size / hw, io, 2 * hw / io * 100);
+    }
+
+    close(fd);
+    unlink(path);
+    free(buf);
+    return 0;
+}
@@ -6,15 +6,26 @@
   See the file COPYING.
 */
 #define FUSE_USE_VERSION 35
+#define _GNU_SOURCE
 #include <fuse.h>
+#include <fuse_lowlevel.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <time.h>
 #include <errno.h>
+#include <sched.h>
+#include <sys/uio.h>
+#ifdef SSD_IO_URING
+#include <liburing.h>
+#endif
 #include "ssd_fuse_header.h"
+#include "ssd_crc32c.h"
 #define SSD_NAME       "ssd_file"
 enum
 {
@@ -30,8 +41,51 @@ enum
 
 #define PCA_ADDR(pca) (pca.nand * PAGE_PER_BLOCK + pca.pidx)
 
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+
+// Device wide counter, requests on different pools bump it concurrently
+#define STAT_ADD(counter, n) __atomic_add_fetch(&(counter), (n), __ATOMIC_RELAXED)
+
+// Default number of NAND operations kept in flight by the io_uring engine
+#define NAND_QUEUE_DEPTH (32)
+
+// Low-level frontend: request size
+#define SSD_LL_MAX_IO    (1024 * 1024)
+
+// Readahead window bounds, in pages
+#define RA_MIN_PAGES     (4)
+#define RA_MAX_PAGES     (32)
+
+// L2P tables are shared between a namespace and its snapshots in chunks
+#define L2P_CHUNK_PAGES  (8)
+#define L2P_PCA(ns, lba) ((ns)->L2P[(lba) / L2P_CHUNK_PAGES]->pca[(lba) % L2P_CHUNK_PAGES])
+
+// In zoned mode a zone is exactly one NAND block
+#define ZONE_SIZE        (PAGE_PER_BLOCK * PAGESIZE)
+
+// Inode of namespace i in the low-level frontend, root is FUSE_ROOT_ID
+#define NS_INO(i)        ((i) + 2)
+
+// Pool 0 is shared by every namespace that has no dedicated blocks,
+// the SLC pool takes one more slot
+#define MAX_POOL_NUM (MAX_NS_NUM + 2)
+#define SHARED_POOL  (0)
+
+// An SLC mode block stores one bit per cell, a third of a dense block
+#define SLC_PAGE_PER_BLOCK (PAGE_PER_BLOCK / 3)
+
+// Folding moves at most one dense block of pages per batch. Below
+// fold_high it waits for the host to be idle this long.
+#define FOLD_BATCH_PAGES (PAGE_PER_BLOCK)
+#define FOLD_IDLE_MS     (100)
+
+// Timing model (--timing), NAND busy time per page or per block
+#define NAND_READ_NS     (20000)
+#define NAND_PROG_NS     (200000)
+#define NAND_SLC_PROG_NS (50000)
+#define NAND_ERASE_NS    (1000000)
+
 static size_t physic_size;
-static size_t logic_size;
 static size_t host_write_size;
 static size_t nand_write_size;
 
@@ -49,6 +103,88 @@ struct pca_rule
     };
 };
 
+typedef struct lba_rule LBA_RULE;
+struct lba_rule
+{
+    union
+    {
+        unsigned int lba;
+        struct
+        {
+            unsigned int lidx: 24;
+            unsigned int nsid: 8;
+        };
+    };
+};
+
+/*
+ * Out-of-band area of a page. seq orders all programs, lba is the P2L
+ * entry of the page when it was programmed and crc the CRC32C of its
+ * data.
+ *
+ * A block file holds the data of its pages back to back, page n at
+ * n * PAGESIZE, followed by the areas of all its pages. Like a
+ * controller, nand_oob keeps the areas of every block in DRAM, they go
+ * to the file with the program of the last page of the block.
+ */
+typedef struct nand_oob NAND_OOB;
+struct nand_oob
+{
+    unsigned long long seq;
+    LBA_RULE lba;
+    uint32_t crc;
+};
+
+/*
+ * Pages a read leaves out because they fail their check, bit n for the
+ * page at buf + n * PAGESIZE. A read without one fails the request.
+ */
+typedef struct nand_bad NAND_BAD;
+struct nand_bad
+{
+    char* buf;
+    unsigned int mask;
+};
+
+/*
+ * NAND commands of one request: how many are still in flight and the
+ * first error they hit. With --timing, done_ns is when the NAND is done
+ * with the last of them, and commands issued after the request waited
+ * for the earlier ones start no sooner than ready_ns.
+ */
+typedef struct nand_req NAND_REQ;
+struct nand_req
+{
+    unsigned int inflight;
+    int error;
+    unsigned long long ready_ns;
+    unsigned long long done_ns;
+};
+
+/*
+ * A NAND command of req on pages [first, first + count) of block, one transfer
+ * of len bytes between iov and the backing file. A read checks the pages
+ * set in mask, at page[], against the owners in lba, the failing ones are
+ * set in bad. The pages in between land in skip.
+ */
+typedef struct nand_cmd NAND_CMD;
+struct nand_cmd
+{
+    NAND_REQ* req;
+    int is_write;
+    unsigned int block;
+    unsigned int first;
+    unsigned int count;
+    unsigned int mask;
+    NAND_BAD* bad;
+    char* page[PAGE_PER_BLOCK];
+    LBA_RULE lba[PAGE_PER_BLOCK];
+    struct iovec iov[PAGE_PER_BLOCK + 1];
+    int iovcnt;
+    size_t len;
+    char skip[PAGESIZE];
+};
+
 typedef struct state_rule STATE_RULE;
 struct state_rule
 {
@@ -64,413 +200,2576 @@ struct state_rule
     };
 };
 
+/*
+ * A set of physical blocks with its own write frontier. Once the last
+ * free block has to be opened, GC picks gc_victim and moves its valid
+ * pages into the frontier a few at a time between host pages.
+ * capacity is the number of logical pages promised to its namespaces.
+ * Blocks of the SLC pool only use their first pages_per_block pages.
+ */
+typedef struct block_pool BLOCK_POOL;
+struct block_pool
+{
+    pthread_mutex_t lock;
+    char* gc_buf;
+    PCA_RULE curr_pca;
+    unsigned int gc_victim;
+    unsigned int free_block_number;
+    unsigned int block_number;
+    unsigned int capacity;
+    unsigned int pages_per_block;
+};
+
+/*
+ * A page picked for folding, buf is its index in the read half of fold_buf
+ */
+typedef struct fold_page FOLD_PAGE;
+struct fold_page
+{
+    LBA_RULE lba;
+    PCA_RULE pca;
+    unsigned int buf;
+};
+
+/*
+ * Readahead state of a read stream. buf caches the pages
+ * [start, start + count), which may still be in flight for req while
+ * pending.
+ * The pages set in bad failed their check and are read again on use.
+ * window is 0 until the stream is seen reading sequentially. next
+ * links the streams reading a namespace.
+ */
+typedef struct ssd_ra SSD_RA;
+struct ssd_ra
+{
+    off_t next_offset;
+    unsigned int window;
+    unsigned int start;
+    unsigned int count;
+    int pending;
+    NAND_REQ req;
+    char* buf;
+    NAND_BAD bad;
+    struct ssd_ra* next;
+};
+
+/*
+ * A slice of an L2P table, ref counts the tables sharing it.
+ * A shared chunk is copied before it is modified.
+ */
+typedef struct l2p_chunk L2P_CHUNK;
+struct l2p_chunk
+{
+    unsigned int ref;
+    PCA_RULE pca[L2P_CHUNK_PAGES];
+};
+
+/*
+ * A zone of a zoned namespace. wp is the next page to write, written
+ * the number of pages programmed (a finished zone has wp at its end).
+ * blockid is OUT_OF_BLOCK until the zone is opened.
+ */
+typedef struct zone ZONE;
+struct zone
+{
+    unsigned int state;
+    unsigned int wp;
+    unsigned int written;
+    unsigned int blockid;
+};
+
+/*
+ * A namespace is exposed as its own file with its own logical size
+ * and L2P table, and writes into the block pool it is bound to.
+ * A snapshot is a read-only namespace whose origin is the namespace it
+ * was taken from. Free slots of ns_table have an empty name, generation
+ * counts the namespaces a slot has held so far.
+ */
+typedef struct ssd_ns SSD_NS;
+struct ssd_ns
+{
+    char name[32];
+    unsigned int generation;
+    size_t logic_size;
+    size_t capacity;
+    L2P_CHUNK** L2P;
+    BLOCK_POOL* pool;
+    struct ssd_ns* origin;
+    unsigned int snapshot_seq;
+    ZONE* zones;
+    unsigned int zone_number;
+    SSD_RA* ra;
+    struct ssd_ns_stat stat;
+};
+
+/*
+ * A namespace file opened by the host, in the fh of its fuse_file_info.
+ * generation is that of the namespace when it was opened, and every
+ * open file follows its own read stream.
+ */
+typedef struct ssd_fh SSD_FH;
+struct ssd_fh
+{
+    SSD_NS* ns;
+    unsigned int generation;
+    SSD_RA ra;
+};
+
 #ifdef DEBUG
 static void debug(void);
 #endif
 
-static int gc(void);
+static unsigned int gc_pick_victim(BLOCK_POOL* pool);
 
-PCA_RULE curr_pca;
-static unsigned int get_next_pca();
+static int gc(BLOCK_POOL* pool);
+
+static int gc_background(BLOCK_POOL* pool);
+
+static unsigned int get_next_pca(BLOCK_POOL* pool);
+
+static unsigned long long ssd_clock_ns(void);
 
-PCA_RULE* L2P;
 STATE_RULE* block_state;
-unsigned int* P2L, free_block_number, gc_blockid;
+LBA_RULE* P2L;
+unsigned char* block_owner;
+// Number of L2P chunks mapping each physical page, stale once it drops to 0
+unsigned char* page_ref;
+
+// Backing file of each NAND block, kept open for the whole mount
+int nand_fd[PHYSICAL_NAND_NUM];
+static NAND_OOB* nand_oob;
+static unsigned long long nand_seq;
+static unsigned long long nand_busy_until[PHYSICAL_NAND_NUM];
+
+// The request this thread issues NAND commands for
+static __thread NAND_REQ* nand_req;
+
+// Command slots, a command holds one from submission to completion.
+// nand_lock guards them along with the ring and the timing model.
+static pthread_mutex_t nand_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t nand_cond = PTHREAD_COND_INITIALIZER;
+static NAND_CMD* nand_cmds;
+static NAND_CMD** nand_cmd_free;
+static unsigned int nand_cmd_number;
+static unsigned int nand_cmd_free_count;
+static unsigned int nand_block_inflight[PHYSICAL_NAND_NUM];
+
+#ifdef SSD_IO_URING
+static struct io_uring ring;
+static int nand_reaping;
+#endif
+
+BLOCK_POOL pools[MAX_POOL_NUM];
+unsigned int pool_number;
+
+static struct ssd_gc_stat gc_stat;
+
+// SLC write cache, NULL unless mounted with --slc. slc_stat also holds
+// the fold thresholds. fold_cond wakes the fold thread.
+static BLOCK_POOL* slc_pool;
+static struct ssd_slc_stat slc_stat;
+static char* fold_buf;
+static pthread_cond_t fold_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long long host_write_ns;
+
+SSD_NS ns_table[MAX_NS_NUM];
+unsigned int ns_number;
 
-static int ssd_resize(size_t new_size)
+// Both frontends dispatch from several threads. A request holds ssd_lock
+// shared and the lock of the pool it runs on, requests on different pools
+// run side by side. Changes to the namespace table hold it exclusively.
+static pthread_rwlock_t ssd_lock;
+
+static struct options
+{
+    const char* ns;
+    unsigned int queue_depth;
+    int lowlevel;
+    int writeback;
+    int zoned;
+    unsigned int slc;
+    int timing;
+} options;
+
+#define OPTION(t, p) { t, offsetof(struct options, p), 1 }
+static const struct fuse_opt option_spec[] =
+{
+    OPTION("--ns=%s", ns),
+    OPTION("--qd=%u", queue_depth),
+    OPTION("--lowlevel", lowlevel),
+    OPTION("--writeback", writeback),
+    OPTION("--zoned", zoned),
+    OPTION("--slc=%u", slc),
+    OPTION("--timing", timing),
+    FUSE_OPT_END
+};
+
+static int ssd_resize(SSD_NS* ns, size_t new_size)
 {
     //set logic size to new_size
-    if (new_size > NAND_SIZE_KB * 1024)
+    if (new_size > ns->capacity)
     {
         return -ENOMEM;
     }
     else
     {
-        logic_size = new_size;
+        ns->logic_size = new_size;
         return 0;
     }
 
 }
 
-static int ssd_expand(size_t new_size)
+static int ssd_expand(SSD_NS* ns, size_t new_size)
 {
     //logic must less logic limit
 
-    if (new_size > logic_size)
+    if (new_size > ns->logic_size)
     {
-        return ssd_resize(new_size);
+        return ssd_resize(ns, new_size);
     }
 
     return 0;
 }
 
-static int nand_read(char* buf, int pca)
+/*
+ * NAND commands are only submitted by nand_read()/nand_write() for the
+ * request in nand_req, a read fills its buffer by the time that
+ * request's nand_wait() returns. Commands of every request share the
+ * slots and the ring, nand_lock guards them. Without io_uring every
+ * command completes before its nand_submit() returns.
+ */
+static void nand_cmd_reset(void)
 {
-    char nand_name[100];
-    FILE* fptr;
-
-    PCA_RULE my_pca;
-    my_pca.pca = pca;
-    snprintf(nand_name, 100, "%s/nand_%d", NAND_LOCATION, my_pca.nand);
-
-    //read
-    if ((fptr = fopen(nand_name, "r")))
-    {
-        fseek(fptr, my_pca.pidx * PAGESIZE, SEEK_SET);
-        fread(buf, 1, PAGESIZE, fptr);
-        fclose(fptr);
-    }
-    else
+    for (nand_cmd_free_count = 0; nand_cmd_free_count < nand_cmd_number; nand_cmd_free_count++)
     {
-        printf("open file fail at nand read pca = %d\n", pca);
-        return -EINVAL;
+        nand_cmd_free[nand_cmd_free_count] = &nand_cmds[nand_cmd_free_count];
     }
-    return PAGESIZE;
 }
 
-static int nand_write(const char* buf, int pca)
+// Fail req, a completion on another thread may fail it at the same time
+static void nand_req_fail(NAND_REQ* req)
 {
-    char nand_name[100];
-    FILE* fptr;
+    __atomic_store_n(&req->error, -EIO, __ATOMIC_RELAXED);
+}
 
-    PCA_RULE my_pca;
-    my_pca.pca = pca;
-    snprintf(nand_name, 100, "%s/nand_%d", NAND_LOCATION, my_pca.nand);
+// Set the page at buf in bad, likewise while its request is in flight
+static void nand_bad_set(NAND_BAD* bad, const char* buf)
+{
+    __atomic_fetch_or(&bad->mask, 1u << ((buf - bad->buf) / PAGESIZE), __ATOMIC_RELAXED);
+}
 
-    //write
-    if ((fptr = fopen(nand_name, "r+")))
+// Page i of cmd failed, left out of the read or failing the request
+static void nand_fail(NAND_CMD* cmd, int i)
+{
+    if (cmd->bad)
     {
-        fseek(fptr, my_pca.pidx * PAGESIZE, SEEK_SET);
-        fwrite(buf, 1, PAGESIZE, fptr);
-        fclose(fptr);
-        physic_size++;
-        block_state[my_pca.nand].valid_count++;
-        block_state[my_pca.nand].free &= ~(1 << my_pca.pidx);
+        nand_bad_set(cmd->bad, cmd->page[i]);
     }
     else
     {
-        printf("open file fail at nand (%s) write pca = %d, return %d\n", nand_name, pca, -EINVAL);
-        return -EINVAL;
-    }
-
-    nand_write_size += PAGESIZE;
-    return PAGESIZE;
-}
-
-static int nand_erase(int block_index)
-{
-    char nand_name[100];
-    FILE* fptr;
-    snprintf(nand_name, 100, "%s/nand_%d", NAND_LOCATION, block_index);
-    fptr = fopen(nand_name, "w");
-    if (fptr == NULL)
-    {
-        printf("erase nand_%d fail", block_index);
-        return 0;
+        nand_req_fail(cmd->req);
     }
-    fclose(fptr);
-    block_state[block_index].state = FREE_BLOCK;
-    return 1;
 }
 
-static unsigned int get_next_block()
+/*
+ * Check a finished command. Every page a read returns must match its
+ * CRC32C and belong to the LBA it was read for. Runs without nand_lock,
+ * an erase waits for the block so its OOB areas stay put.
+ */
+static void nand_check(NAND_CMD* cmd, int res)
 {
-    for (int i = 0; i < PHYSICAL_NAND_NUM; i++)
+    if (res != cmd->len)
     {
-        if (block_state[(curr_pca.nand + i) % PHYSICAL_NAND_NUM].state == FREE_BLOCK)
+        printf("nand io fail at nand_%u, return %d\n", cmd->block, res);
+        for (int i = 0; i < cmd->count; i++)
         {
-            curr_pca.nand = (curr_pca.nand + i) % PHYSICAL_NAND_NUM;
-            curr_pca.pidx = 0;
-            free_block_number--;
-            block_state[curr_pca.nand].state = 0;
-            block_state[curr_pca.nand].free = (1 << PAGE_PER_BLOCK) - 1;
-            return curr_pca.pca;
+            if (cmd->mask & (1 << (cmd->first + i)))
+            {
+                nand_fail(cmd, i);
+            }
         }
     }
-    return OUT_OF_BLOCK;
-}
-
-static unsigned int get_next_pca()
-{
-    //init
-    if (curr_pca.pca == INVALID_PCA)
+    else if (!cmd->is_write)
     {
-        curr_pca.pca = 0;
-        block_state[0].state = 0;
-        block_state[curr_pca.nand].free = (1 << PAGE_PER_BLOCK) - 1;
-        free_block_number--;
-        return curr_pca.pca;
-    }
+        NAND_OOB* oob = &nand_oob[cmd->block * PAGE_PER_BLOCK + cmd->first];
 
-    do
-    {
-        if (block_state[curr_pca.nand].free)
+        for (int i = 0; i < cmd->count; i++)
         {
-            curr_pca.pidx = ffs(block_state[curr_pca.nand].free) - 1;
-
-            return curr_pca.pca;
-        }
+            if (!(cmd->mask & (1 << (cmd->first + i))))
+            {
+                continue;
+            }
 
-        if (free_block_number != 1)
-        {
-            return get_next_block();
+            if (oob[i].crc != crc32c(0, cmd->page[i], PAGESIZE) ||
+                oob[i].lba.lba != cmd->lba[i].lba)
+            {
+                printf("nand crc fail at nand_%u page %u, lba %#x seq %llu\n",
+                       cmd->block, cmd->first + i, oob[i].lba.lba, oob[i].seq);
+                nand_fail(cmd, i);
+            }
         }
-
-        gc();
-    } while (1);
+    }
 }
 
 /*
- * 1. Check L2P to get PCA
- * 2. Send read data into tmp_buffer
+ * With nand_lock held, retire a checked command and give its slot back
  */
-static int ftl_read(char* buf, int lba)
+static void nand_complete(NAND_CMD* cmd)
 {
-    PCA_RULE pca;
-    int ret;
-
-    pca.pca = L2P[lba].pca;
-
-    if (pca.pca == INVALID_PCA)
-    {
-        memset(buf, 0, PAGESIZE);
-        return PAGESIZE;
-    }
-
-    ret = nand_read(buf, pca.pca);
-
-    return ret;
+    cmd->req->inflight--;
+    cmd->req = NULL;
+    nand_block_inflight[cmd->block]--;
+    nand_cmd_free[nand_cmd_free_count++] = cmd;
+    pthread_cond_broadcast(&nand_cond);
 }
 
 /*
- * 1. Allocate a new PCA address
- * 2. Send NAND-write cmd
- * 3. Update L2P table
+ * With nand_lock held, wait for at least one command to complete. Under
+ * io_uring one thread at a time reaps, with nand_lock dropped, and the
+ * others wait for it.
  */
-static int ftl_write(const char* buf, int lba_range, int lba)
+static void nand_progress(void)
 {
-    PCA_RULE pca, oldpca;
+#ifdef SSD_IO_URING
+    struct io_uring_cqe* cqe;
+    NAND_CMD* cmd;
     int ret;
 
-    oldpca.pca = L2P[lba].pca;
+    io_uring_submit(&ring);
+    if (nand_reaping)
+    {
+        pthread_cond_wait(&nand_cond, &nand_lock);
+        return;
+    }
 
-    // Set stale
-    if (oldpca.pca != INVALID_PCA)
+    nand_reaping = 1;
+    pthread_mutex_unlock(&nand_lock);
+    ret = io_uring_wait_cqe(&ring, &cqe);
+    if (ret == 0)
     {
-        block_state[oldpca.nand].valid_count--;
-        block_state[oldpca.nand].stale |= (1 << oldpca.pidx);
+        cmd = io_uring_cqe_get_data(cqe);
+        nand_check(cmd, cqe->res);
+        io_uring_cqe_seen(&ring, cqe);
     }
+    pthread_mutex_lock(&nand_lock);
+    nand_reaping = 0;
 
-    pca.pca = get_next_pca();
+    if (ret == 0)
+    {
+        nand_complete(cmd);
+        return;
+    }
 
-    if (pca.pca < 0 || pca.pca == OUT_OF_BLOCK)
+    // The ring is gone, every command in flight fails its request
+    for (unsigned int i = 0; i < nand_cmd_number; i++)
     {
-        return 0;
+        if (nand_cmds[i].req)
+        {
+            nand_req_fail(nand_cmds[i].req);
+            nand_complete(&nand_cmds[i]);
+        }
     }
+#else
+    pthread_cond_wait(&nand_cond, &nand_lock);
+#endif
+}
 
-    ret = nand_write(buf, pca.pca);
+static NAND_CMD* nand_cmd_get(void)
+{
+    NAND_CMD* cmd;
 
-    L2P[lba].pca = pca.pca;
-    P2L[PCA_ADDR(pca)] = lba;
+    pthread_mutex_lock(&nand_lock);
+    while (!nand_cmd_free_count)
+    {
+        nand_progress();
+    }
+    cmd = nand_cmd_free[--nand_cmd_free_count];
+    pthread_mutex_unlock(&nand_lock);
 
-    return ret;
+    return cmd;
 }
 
 /*
- * 1. Decide the target block to be erase
- * 2. Move all the valid data that in target block to another block
- * 3. Erase the target block when all the data in target block are stale
- * 4. Mark the target block as available
- * 5. Continue until the number of blocks that you erased reach your goal
+ * Timing model: with --timing every block is a die of its own, busy for
+ * a fixed time per page read or programmed and per block erased. A
+ * request is done once the blocks it used have caught up with its
+ * commands, an erase holds up no request that stays off its block.
+ * Called with nand_lock held.
  */
-static int gc(void)
+static void nand_busy(NAND_REQ* req, unsigned int block, unsigned long long ns)
 {
-    int blockid, minv, valid;
-    char* buf;
-    PCA_RULE target_pca;
-
-    blockid = -1;
-    minv = PAGE_PER_BLOCK + 1;
+    unsigned long long start;
 
-    for (int i = 0; i < PHYSICAL_NAND_NUM; ++i)
+    if (!options.timing)
     {
-        if (i == gc_blockid)
-        {
-            continue;
-        }
-
-        if (block_state[i].valid_count < minv)
-        {
-            minv = block_state[i].valid_count;
-            blockid = i;
-        }
+        return;
     }
 
-    if (minv == PAGE_PER_BLOCK)
+    start = ssd_clock_ns();
+    if (start < req->ready_ns)
     {
-        // No space
-        return -1;
+        start = req->ready_ns;
     }
-
-    buf = calloc(PAGESIZE, sizeof(char));
-
-    target_pca.nand = blockid;
-
-    curr_pca.nand = gc_blockid;
-    curr_pca.pidx = 0;
-
-    block_state[gc_blockid].state = 0;
-    block_state[gc_blockid].free = (1 << PAGE_PER_BLOCK) - 1;
-
-    valid = ~block_state[blockid].free & ((1 << PAGE_PER_BLOCK) - 1);
-    valid &= ~block_state[blockid].stale;
-
-    while (valid)
+    if (start < nand_busy_until[block])
     {
-        int pidx;
-        int lba;
-
-        pidx = ffs(valid) - 1;
-
-        if (pidx == -1) {
-            break;
-        }
-
-        target_pca.pidx = pidx;
-
-        nand_read(buf, target_pca.pca);
-        nand_write(buf, curr_pca.pca);
+        start = nand_busy_until[block];
+    }
+    nand_busy_until[block] = start + ns;
 
-        lba = P2L[PCA_ADDR(target_pca)];
+    if (req->done_ns < nand_busy_until[block])
+    {
+        req->done_ns = nand_busy_until[block];
+    }
+}
 
-        L2P[lba].pca = curr_pca.pca;
+static void nand_submit(NAND_CMD* cmd)
+{
+    int fd = nand_fd[cmd->block];
+    off_t offset = cmd->first * PAGESIZE;
 
-        P2L[PCA_ADDR(curr_pca)] = lba;
-        P2L[PCA_ADDR(target_pca)] = INVALID_LBA;
-        
-        curr_pca.pidx++;
+    pthread_mutex_lock(&nand_lock);
+    cmd->req = nand_req;
+    cmd->req->inflight++;
+    nand_block_inflight[cmd->block]++;
 
-        valid &= ~(1 << pidx);
+    if (!cmd->is_write)
+    {
+        nand_busy(cmd->req, cmd->block, cmd->count * NAND_READ_NS);
+    }
+    else if (&pools[block_owner[cmd->block]] == slc_pool)
+    {
+        nand_busy(cmd->req, cmd->block, cmd->count * NAND_SLC_PROG_NS);
+    }
+    else
+    {
+        nand_busy(cmd->req, cmd->block, cmd->count * NAND_PROG_NS);
     }
 
-    free(buf);
-
-    nand_erase(blockid);
-
-    gc_blockid = blockid;
+    // A single iovec is cheaper as a plain read or write
+#ifdef SSD_IO_URING
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
 
-    return 0;
-}
+    if (cmd->iovcnt == 1 && cmd->is_write)
+    {
+        io_uring_prep_write(sqe, fd, cmd->iov[0].iov_base, cmd->len, offset);
+    }
+    else if (cmd->iovcnt == 1)
+    {
+        io_uring_prep_read(sqe, fd, cmd->iov[0].iov_base, cmd->len, offset);
+    }
+    else if (cmd->is_write)
+    {
+        io_uring_prep_writev(sqe, fd, cmd->iov, cmd->iovcnt, offset);
+    }
+    else
+    {
+        io_uring_prep_readv(sqe, fd, cmd->iov, cmd->iovcnt, offset);
+    }
+    io_uring_sqe_set_data(sqe, cmd);
+#else
+    int res;
 
-static int ssd_file_type(const char* path)
-{
-    if (strcmp(path, "/") == 0)
+    pthread_mutex_unlock(&nand_lock);
+    if (cmd->iovcnt == 1 && cmd->is_write)
     {
-        return SSD_ROOT;
+        res = pwrite(fd, cmd->iov[0].iov_base, cmd->len, offset);
     }
-    if (strcmp(path, "/" SSD_NAME) == 0)
+    else if (cmd->iovcnt == 1)
     {
-        return SSD_FILE;
+        res = pread(fd, cmd->iov[0].iov_base, cmd->len, offset);
     }
-    return SSD_NONE;
+    else
+    {
+        res = cmd->is_write ? pwritev(fd, cmd->iov, cmd->iovcnt, offset) :
+              preadv(fd, cmd->iov, cmd->iovcnt, offset);
+    }
+    nand_check(cmd, res);
+    pthread_mutex_lock(&nand_lock);
+    nand_complete(cmd);
+#endif
+    pthread_mutex_unlock(&nand_lock);
 }
 
-static int ssd_getattr(const char* path, struct stat* stbuf,
-                       struct fuse_file_info* fi)
+/*
+ * Wait for every command of req. Their errors stay pending in req for
+ * the nand_wait() of the request that issued them. The modelled NAND
+ * time is only waited out by nand_req_sleep(), once the request let go
+ * of its locks, the commands it issues from here on start after it.
+ */
+static void nand_req_drain(NAND_REQ* req)
 {
-    (void) fi;
-    stbuf->st_uid = getuid();
-    stbuf->st_gid = getgid();
-    stbuf->st_atime = stbuf->st_mtime = time(NULL);
-    switch (ssd_file_type(path))
+    pthread_mutex_lock(&nand_lock);
+    while (req->inflight)
     {
-        case SSD_ROOT:
-            stbuf->st_mode = S_IFDIR | 0755;
-            stbuf->st_nlink = 2;
-            break;
-        case SSD_FILE:
-            stbuf->st_mode = S_IFREG | 0644;
-            stbuf->st_nlink = 1;
-            stbuf->st_size = logic_size;
-            break;
-        case SSD_NONE:
-            return -ENOENT;
+        nand_progress();
     }
-    return 0;
+    pthread_mutex_unlock(&nand_lock);
+
+    req->ready_ns = req->done_ns;
 }
 
-static int ssd_open(const char* path, struct fuse_file_info* fi)
+static void nand_req_sleep(NAND_REQ* req)
 {
-    (void) fi;
-    if (ssd_file_type(path) != SSD_NONE)
+    if (options.timing && req->done_ns > ssd_clock_ns())
     {
-        return 0;
+        struct timespec ts;
+
+        ts.tv_sec = req->done_ns / 1000000000ULL;
+        ts.tv_nsec = req->done_ns % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+static void nand_drain(void)
+{
+    nand_req_drain(nand_req);
+}
+
+/*
+ * Complete the request: wait for its commands and take its error
+ */
+static int nand_wait(void)
+{
+    int ret;
+
+    nand_drain();
+
+    ret = nand_req->error;
+    nand_req->error = 0;
+    return ret;
+}
+
+/*
+ * Read count pages starting at pca, they must all be in the same block.
+ * They are checked against the owners P2L gives them now, the failing
+ * ones are set in bad if it is not NULL.
+ */
+static int nand_read_pages(char* buf, int pca, int count, NAND_BAD* bad)
+{
+    PCA_RULE my_pca;
+    NAND_CMD* cmd;
+    my_pca.pca = pca;
+
+    if (my_pca.nand >= PHYSICAL_NAND_NUM || my_pca.pidx + count > PAGE_PER_BLOCK)
+    {
+        printf("open file fail at nand read pca = %d\n", pca);
+        return -EINVAL;
+    }
+
+    //read
+    cmd = nand_cmd_get();
+    cmd->is_write = 0;
+    cmd->block = my_pca.nand;
+    cmd->first = my_pca.pidx;
+    cmd->count = count;
+    cmd->mask = ((1 << count) - 1) << my_pca.pidx;
+    cmd->bad = bad;
+    for (int i = 0; i < count; i++)
+    {
+        cmd->page[i] = &buf[PAGESIZE * i];
+        cmd->lba[i] = P2L[PCA_ADDR(my_pca) + i];
+    }
+    cmd->iov[0].iov_base = buf;
+    cmd->iov[0].iov_len = cmd->len = PAGESIZE * count;
+    cmd->iovcnt = 1;
+    nand_submit(cmd);
+
+    return PAGESIZE * count;
+}
+
+static int nand_read(char* buf, int pca)
+{
+    return nand_read_pages(buf, pca, 1, NULL);
+}
+
+/*
+ * Read the pages of block set in mask back to back into buf, with one
+ * read from the first to the last of them. The pages in between that
+ * are not in mask are dropped in skip, the failing ones are set in bad.
+ */
+static int nand_read_mask(char* buf, unsigned int block, unsigned int mask, NAND_BAD* bad)
+{
+    NAND_CMD* cmd;
+    int first, last, count;
+
+    if (block >= PHYSICAL_NAND_NUM || !mask || mask >> PAGE_PER_BLOCK)
+    {
+        printf("open file fail at nand read nand_%u mask = %#x\n", block, mask);
+        return -EINVAL;
+    }
+
+    first = ffs(mask) - 1;
+    last = 31 - __builtin_clz(mask);
+
+    //read
+    cmd = nand_cmd_get();
+    cmd->is_write = 0;
+    cmd->block = block;
+    cmd->first = first;
+    cmd->count = last - first + 1;
+    cmd->mask = mask;
+    cmd->bad = bad;
+
+    count = 0;
+    cmd->iovcnt = 0;
+    for (int pidx = first; pidx <= last; pidx++)
+    {
+        struct iovec* iov = &cmd->iov[cmd->iovcnt];
+
+        cmd->lba[pidx - first] = P2L[block * PAGE_PER_BLOCK + pidx];
+        if (!(mask & (1 << pidx)))
+        {
+            cmd->page[pidx - first] = NULL;
+            iov->iov_base = cmd->skip;
+        }
+        else if (pidx > first && mask & (1 << (pidx - 1)))
+        {
+            // Pages next to each other in the block stay so in buf
+            cmd->page[pidx - first] = &buf[PAGESIZE * count++];
+            iov[-1].iov_len += PAGESIZE;
+            continue;
+        }
+        else
+        {
+            cmd->page[pidx - first] = &buf[PAGESIZE * count++];
+            iov->iov_base = cmd->page[pidx - first];
+        }
+        iov->iov_len = PAGESIZE;
+        cmd->iovcnt++;
+    }
+    cmd->len = PAGESIZE * cmd->count;
+    nand_submit(cmd);
+
+    return PAGESIZE * count;
+}
+
+/*
+ * Program count pages starting at pca, they must all be in the same block.
+ * The OOB area of each page records its P2L entry, which must be set first.
+ * buf must stay untouched until the request's nand_wait().
+ */
+static int nand_write_pages(const char* buf, int pca, int count)
+{
+    PCA_RULE my_pca;
+    NAND_CMD* cmd;
+    unsigned int pages;
+    my_pca.pca = pca;
+
+    if (my_pca.nand >= PHYSICAL_NAND_NUM || my_pca.pidx + count > PAGE_PER_BLOCK)
+    {
+        printf("open file fail at nand write pca = %d, return %d\n", pca, -EINVAL);
+        return -EINVAL;
+    }
+
+    //write
+    cmd = nand_cmd_get();
+    cmd->is_write = 1;
+    cmd->block = my_pca.nand;
+    cmd->first = my_pca.pidx;
+    cmd->count = count;
+    cmd->mask = ((1 << count) - 1) << my_pca.pidx;
+    cmd->bad = NULL;
+    for (int i = 0; i < count; i++)
+    {
+        NAND_OOB* oob = &nand_oob[PCA_ADDR(my_pca) + i];
+
+        oob->lba = P2L[PCA_ADDR(my_pca) + i];
+        oob->seq = __atomic_add_fetch(&nand_seq, 1, __ATOMIC_RELAXED);
+        oob->crc = crc32c(0, &buf[PAGESIZE * i], PAGESIZE);
+    }
+    cmd->iov[0].iov_base = (char*)buf;
+    cmd->iov[0].iov_len = cmd->len = PAGESIZE * count;
+    cmd->iovcnt = 1;
+
+    // The last page of the block takes the OOB areas of all its pages along
+    pages = pools[block_owner[my_pca.nand]].pages_per_block;
+    if (my_pca.pidx + count == pages)
+    {
+        cmd->iov[1].iov_base = &nand_oob[my_pca.nand * PAGE_PER_BLOCK];
+        cmd->iov[1].iov_len = pages * sizeof(NAND_OOB);
+        cmd->len += cmd->iov[1].iov_len;
+        cmd->iovcnt = 2;
+    }
+
+    // The slot may be reused as soon as the command is submitted
+    STAT_ADD(physic_size, count);
+    block_state[my_pca.nand].valid_count += count;
+    block_state[my_pca.nand].free &= ~cmd->mask;
+    nand_submit(cmd);
+
+    STAT_ADD(nand_write_size, PAGESIZE * count);
+    return PAGESIZE * count;
+}
+
+static int nand_write(const char* buf, int pca)
+{
+    return nand_write_pages(buf, pca, 1);
+}
+
+static int nand_erase(int block_index)
+{
+    // Nothing of any request may still be in flight on the block
+    pthread_mutex_lock(&nand_lock);
+    while (nand_block_inflight[block_index])
+    {
+        nand_progress();
+    }
+    pthread_mutex_unlock(&nand_lock);
+
+    if (ftruncate(nand_fd[block_index], 0) < 0)
+    {
+        printf("erase nand_%d fail", block_index);
+        return 0;
+    }
+    memset(&nand_oob[block_index * PAGE_PER_BLOCK], 0, PAGE_PER_BLOCK * sizeof(NAND_OOB));
+
+    pthread_mutex_lock(&nand_lock);
+    nand_busy(nand_req, block_index, NAND_ERASE_NS);
+    pthread_mutex_unlock(&nand_lock);
+    block_state[block_index].state = FREE_BLOCK;
+    return 1;
+}
+
+static unsigned int get_next_block(BLOCK_POOL* pool)
+{
+    unsigned int start;
+
+    start = pool->curr_pca.pca == INVALID_PCA ? 0 : pool->curr_pca.nand;
+
+    for (int i = 0; i < PHYSICAL_NAND_NUM; i++)
+    {
+        unsigned int blockid = (start + i) % PHYSICAL_NAND_NUM;
+
+        if (&pools[block_owner[blockid]] != pool)
+        {
+            continue;
+        }
+
+        if (block_state[blockid].state == FREE_BLOCK)
+        {
+            pool->curr_pca.nand = blockid;
+            pool->curr_pca.pidx = 0;
+            pool->free_block_number--;
+            block_state[blockid].state = 0;
+            block_state[blockid].free = (1 << pool->pages_per_block) - 1;
+            return pool->curr_pca.pca;
+        }
+    }
+    return OUT_OF_BLOCK;
+}
+
+static unsigned int get_next_pca(BLOCK_POOL* pool)
+{
+    unsigned int pending;
+
+    do
+    {
+        pending = 0;
+        if (pool->gc_victim != OUT_OF_BLOCK)
+        {
+            pending = block_state[pool->gc_victim].valid_count;
+        }
+
+        // Leave room in the frontier for what is left of the GC victim
+        if (pool->curr_pca.pca != INVALID_PCA &&
+            __builtin_popcount(block_state[pool->curr_pca.nand].free) > pending)
+        {
+            pool->curr_pca.pidx = ffs(block_state[pool->curr_pca.nand].free) - 1;
+
+            return pool->curr_pca.pca;
+        }
+
+        if (pool->gc_victim != OUT_OF_BLOCK)
+        {
+            if (gc(pool) < 0)
+            {
+                return OUT_OF_BLOCK;
+            }
+            continue;
+        }
+
+        // The last free block is only opened along with a victim to reclaim
+        if (pool->free_block_number == 1)
+        {
+            pool->gc_victim = gc_pick_victim(pool);
+            if (pool->gc_victim == OUT_OF_BLOCK)
+            {
+                // No space
+                return OUT_OF_BLOCK;
+            }
+        }
+
+        return get_next_block(pool);
+    } while (1);
+}
+
+/*
+ * 1. Check L2P to get PCA, a page GC could not read back fails the request
+ * 2. Send read data into tmp_buffer, valid after nand_wait()
+ */
+static int ftl_read(SSD_NS* ns, char* buf, int lba)
+{
+    PCA_RULE pca;
+    int ret;
+
+    pca.pca = L2P_PCA(ns, lba).pca;
+
+    if (pca.pca == INVALID_PCA || pca.pca == BAD_PCA)
+    {
+        if (pca.pca == BAD_PCA)
+        {
+            nand_req_fail(nand_req);
+        }
+        memset(buf, 0, PAGESIZE);
+        return PAGESIZE;
+    }
+
+    ret = nand_read(buf, pca.pca);
+
+    return ret;
+}
+
+/*
+ * Submit reads of count pages from lba, with one backing read per run
+ * of pages that sit next to each other in the same block. Pages that
+ * fail are set in bad if it is not NULL, they fail the request otherwise.
+ * Return the number of pages submitted.
+ */
+static int ftl_read_range(SSD_NS* ns, char* buf, int lba, int count, NAND_BAD* bad)
+{
+    int idx, run;
+    PCA_RULE pca;
+
+    idx = 0;
+    while (idx < count)
+    {
+        pca.pca = L2P_PCA(ns, lba + idx).pca;
+
+        if (pca.pca == INVALID_PCA || pca.pca == BAD_PCA)
+        {
+            if (pca.pca == BAD_PCA && bad)
+            {
+                nand_bad_set(bad, &buf[idx * PAGESIZE]);
+            }
+            else if (pca.pca == BAD_PCA)
+            {
+                nand_req_fail(nand_req);
+            }
+            memset(&buf[idx * PAGESIZE], 0, PAGESIZE);
+            idx++;
+            continue;
+        }
+
+        for (run = 1; idx + run < count; run++)
+        {
+            if (L2P_PCA(ns, lba + idx + run).pca != pca.pca + run)
+            {
+                break;
+            }
+        }
+
+        if (nand_read_pages(&buf[idx * PAGESIZE], pca.pca, run, bad) <= 0)
+        {
+            break;
+        }
+
+        idx += run;
+    }
+
+    return idx;
+}
+
+// Whether an L2P entry points at a physical page
+static int page_mapped(PCA_RULE pca)
+{
+    return pca.pca != INVALID_PCA && pca.pca != BAD_PCA;
+}
+
+/*
+ * Drop one reference to a physical page, set it stale on the last one
+ */
+static void page_put(PCA_RULE pca)
+{
+    if (--page_ref[PCA_ADDR(pca)])
+    {
+        return;
+    }
+
+    block_state[pca.nand].valid_count--;
+    block_state[pca.nand].stale |= (1 << pca.pidx);
+    P2L[PCA_ADDR(pca)].lba = INVALID_LBA;
+}
+
+static void l2p_chunk_put(L2P_CHUNK* chunk)
+{
+    if (--chunk->ref)
+    {
+        return;
+    }
+
+    for (int i = 0; i < L2P_CHUNK_PAGES; i++)
+    {
+        if (page_mapped(chunk->pca[i]))
+        {
+            page_put(chunk->pca[i]);
+        }
+    }
+    free(chunk);
+}
+
+/*
+ * Map lba of ns to pca, copying the chunk first if a snapshot shares it
+ */
+static void l2p_set(SSD_NS* ns, int lba, unsigned int pca)
+{
+    L2P_CHUNK* chunk;
+    PCA_RULE oldpca;
+
+    chunk = ns->L2P[lba / L2P_CHUNK_PAGES];
+    if (chunk->ref > 1)
+    {
+        chunk = malloc(sizeof(L2P_CHUNK));
+        memcpy(chunk, ns->L2P[lba / L2P_CHUNK_PAGES], sizeof(L2P_CHUNK));
+        chunk->ref = 1;
+        for (int i = 0; i < L2P_CHUNK_PAGES; i++)
+        {
+            if (page_mapped(chunk->pca[i]))
+            {
+                page_ref[PCA_ADDR(chunk->pca[i])]++;
+            }
+        }
+        ns->L2P[lba / L2P_CHUNK_PAGES]->ref--;
+        ns->L2P[lba / L2P_CHUNK_PAGES] = chunk;
+    }
+
+    oldpca = chunk->pca[lba % L2P_CHUNK_PAGES];
+    chunk->pca[lba % L2P_CHUNK_PAGES].pca = pca;
+
+    if (page_mapped(chunk->pca[lba % L2P_CHUNK_PAGES]))
+    {
+        page_ref[PCA_ADDR(chunk->pca[lba % L2P_CHUNK_PAGES])]++;
+    }
+    if (page_mapped(oldpca))
+    {
+        page_put(oldpca);
+    }
+}
+
+/*
+ * Drop the readahead buffers of ns that hold lba
+ */
+static void ftl_ra_drop(SSD_NS* ns, int lba)
+{
+    for (SSD_RA* ra = ns->ra; ra; ra = ra->next)
+    {
+        if (lba >= ra->start && lba < ra->start + ra->count)
+        {
+            ra->count = 0;
+        }
+    }
+}
+
+/*
+ * 1. Drop lba from the readahead buffer
+ * 2. Unmap lba, its page is set stale unless a snapshot still maps it
+ */
+static void ftl_trim(SSD_NS* ns, int lba)
+{
+    ftl_ra_drop(ns, lba);
+
+    if (L2P_PCA(ns, lba).pca == INVALID_PCA)
+    {
+        return;
+    }
+
+    l2p_set(ns, lba, INVALID_PCA);
+}
+
+/*
+ * Number of SLC blocks with no free page left, waiting to be folded
+ */
+static unsigned int slc_full_blocks(void)
+{
+    unsigned int full = 0;
+
+    for (int i = 0; i < PHYSICAL_NAND_NUM; i++)
+    {
+        if (&pools[block_owner[i]] == slc_pool &&
+            block_state[i].state != FREE_BLOCK && !block_state[i].free)
+        {
+            full++;
+        }
+    }
+    return full;
+}
+
+/*
+ * Next page of the SLC pool. It has no GC, folding frees its blocks.
+ */
+static unsigned int slc_next_pca(void)
+{
+    PCA_RULE* curr = &slc_pool->curr_pca;
+
+    if (curr->pca != INVALID_PCA && block_state[curr->nand].free)
+    {
+        curr->pidx = ffs(block_state[curr->nand].free) - 1;
+        return curr->pca;
+    }
+    if (!slc_pool->free_block_number)
+    {
+        return OUT_OF_BLOCK;
+    }
+    return get_next_block(slc_pool);
+}
+
+/*
+ * Host pages land in the SLC pool while it has room, in the pool of
+ * their namespace once it is full
+ */
+static unsigned int host_next_pca(SSD_NS* ns)
+{
+    unsigned int pca;
+
+    if (!slc_pool)
+    {
+        return get_next_pca(ns->pool);
+    }
+
+    host_write_ns = ssd_clock_ns();
+
+    pca = slc_next_pca();
+    if (slc_full_blocks() >= slc_stat.fold_high)
+    {
+        pthread_cond_signal(&fold_cond);
+    }
+    if (pca != OUT_OF_BLOCK)
+    {
+        slc_stat.host_pages++;
+        return pca;
+    }
+
+    slc_stat.bypass_pages++;
+    return get_next_pca(ns->pool);
+}
+
+/*
+ * 1. Allocate a new PCA address, lba keeps its old page if that fails
+ * 2. Update L2P and P2L table, the old page is set stale unless a
+ *    snapshot still maps it
+ * 3. Send NAND-write cmd, its OOB area records the P2L entry
+ */
+static int ftl_write(SSD_NS* ns, const char* buf, int lba_range, int lba)
+{
+    PCA_RULE pca;
+    int ret;
+
+    pca.pca = host_next_pca(ns);
+
+    if (pca.pca < 0 || pca.pca == OUT_OF_BLOCK)
+    {
+        return 0;
+    }
+
+    ftl_ra_drop(ns, lba);
+    l2p_set(ns, lba, pca.pca);
+    P2L[PCA_ADDR(pca)].nsid = ns - ns_table;
+    P2L[PCA_ADDR(pca)].lidx = lba;
+
+    ret = nand_write(buf, pca.pca);
+    ns->stat.nand_write_size += PAGESIZE;
+
+    // The copies of a GC step go out as part of this request
+    if (ret > 0 && gc_background(ns->pool) == -EIO)
+    {
+        return -EIO;
+    }
+
+    return ret;
+}
+
+/*
+ * Pick the block of the pool with the fewest valid pages. Blocks still
+ * being written are left alone, as are blocks with nothing to reclaim.
+ */
+static unsigned int gc_pick_victim(BLOCK_POOL* pool)
+{
+    unsigned int blockid, minv;
+
+    blockid = OUT_OF_BLOCK;
+    minv = PAGE_PER_BLOCK;
+
+    for (int i = 0; i < PHYSICAL_NAND_NUM; ++i)
+    {
+        if (&pools[block_owner[i]] != pool ||
+            block_state[i].state == FREE_BLOCK || block_state[i].free)
+        {
+            continue;
+        }
+
+        if (block_state[i].valid_count < minv)
+        {
+            minv = block_state[i].valid_count;
+            blockid = i;
+        }
+    }
+
+    return blockid;
+}
+
+/*
+ * Point every mapping of the page at from to its copy at to, before
+ * the program that records the new P2L entry. from becomes stale.
+ * A page that could not be read back moves to BAD_PCA, its LBA then
+ * fails reads until it is written again.
+ */
+static void page_move(PCA_RULE from, PCA_RULE to)
+{
+    LBA_RULE lba;
+    SSD_NS* ns;
+
+    lba = P2L[PCA_ADDR(from)];
+    ns = &ns_table[lba.nsid];
+
+    // Every chunk still mapping the page follows it, whether it
+    // belongs to the namespace or to one of its snapshots
+    for (int i = 0; i < ns_number; i++)
+    {
+        if (&ns_table[i] != ns && ns_table[i].origin != ns)
+        {
+            continue;
+        }
+        if (L2P_PCA(&ns_table[i], lba.lidx).pca == from.pca)
+        {
+            L2P_PCA(&ns_table[i], lba.lidx).pca = to.pca;
+        }
+    }
+    if (to.pca != BAD_PCA)
+    {
+        ns->stat.nand_write_size += PAGESIZE;
+        page_ref[PCA_ADDR(to)] = page_ref[PCA_ADDR(from)];
+        P2L[PCA_ADDR(to)] = lba;
+    }
+
+    page_ref[PCA_ADDR(from)] = 0;
+    P2L[PCA_ADDR(from)].lba = INVALID_LBA;
+
+    block_state[from.nand].stale |= 1 << from.pidx;
+    block_state[from.nand].valid_count--;
+}
+
+/*
+ * One step of reclaiming the victim block of a pool
+ * 1. Move up to budget of its valid pages to the write frontier
+ * 2. Once it holds no valid page, erase it as a step of its own so
+ *    no request waits behind both the copies and the erase
+ * Return -ENOSPC if the frontier has no room for the copies and -EIO
+ * if the request running the step has failed I/O.
+ */
+static int gc_step(BLOCK_POOL* pool, int budget)
+{
+    unsigned int valid, move;
+    int count;
+    PCA_RULE target_pca, curr_pca, dest_pca, lost_pca;
+    NAND_BAD bad;
+
+    target_pca.nand = pool->gc_victim;
+
+    valid = ~block_state[target_pca.nand].free & ((1 << PAGE_PER_BLOCK) - 1);
+    valid &= ~block_state[target_pca.nand].stale;
+
+    if (!valid)
+    {
+        nand_erase(target_pca.nand);
+        pool->free_block_number++;
+        pool->gc_victim = OUT_OF_BLOCK;
+        STAT_ADD(gc_stat.erased_blocks, 1);
+        return 0;
+    }
+
+    // The frontier always keeps room for the rest of the victim
+    curr_pca = pool->curr_pca;
+    if (curr_pca.pca == INVALID_PCA ||
+        __builtin_popcount(block_state[curr_pca.nand].free) < __builtin_popcount(valid))
+    {
+        return -ENOSPC;
+    }
+
+    move = 0;
+    while (valid && budget--)
+    {
+        move |= valid & -valid;
+        valid &= valid - 1;
+    }
+
+    curr_pca.pidx = ffs(block_state[curr_pca.nand].free) - 1;
+
+    // Host writes still in flight may target the victim, their errors
+    // belong to the request
+    nand_drain();
+    if (nand_req->error < 0)
+    {
+        return -EIO;
+    }
+
+    // Copy back: the pages of the step are read with one read of the
+    // victim and land back to back in the frontier with one program
+    bad.buf = pool->gc_buf;
+    bad.mask = 0;
+    if (nand_read_mask(pool->gc_buf, target_pca.nand, move, &bad) <= 0)
+    {
+        return -EIO;
+    }
+    nand_drain();
+
+    // Every mapping follows its page to the new copy. A page failing its
+    // CRC32C is lost rather than left to pin the victim.
+    dest_pca = curr_pca;
+    lost_pca.pca = BAD_PCA;
+    count = 0;
+    for (int i = 0; move; i++)
+    {
+        target_pca.pidx = ffs(move) - 1;
+        move &= move - 1;
+
+        if (bad.mask & (1u << i))
+        {
+            printf("gc lost lba %#x at nand_%u page %u\n", P2L[PCA_ADDR(target_pca)].lba,
+                   target_pca.nand, target_pca.pidx);
+            page_move(target_pca, lost_pca);
+            STAT_ADD(gc_stat.lost_pages, 1);
+            continue;
+        }
+
+        memmove(&pool->gc_buf[count * PAGESIZE], &pool->gc_buf[i * PAGESIZE], PAGESIZE);
+        page_move(target_pca, curr_pca);
+        curr_pca.pidx++;
+        count++;
+    }
+    if (count)
+    {
+        nand_write_pages(pool->gc_buf, dest_pca.pca, count);
+    }
+
+    STAT_ADD(gc_stat.copied_pages, count);
+
+    // The mappings already point at the copies, a failed program fails
+    // the request running the step
+    nand_drain();
+
+    return nand_req->error < 0 ? -EIO : 0;
+}
+
+/*
+ * Finish the victim block of a pool at once, when the host needs the
+ * room it still reserves in the frontier
+ */
+static int gc(BLOCK_POOL* pool)
+{
+    unsigned long long start;
+    int ret;
+
+    start = ssd_clock_ns();
+
+    ret = 0;
+    while (pool->gc_victim != OUT_OF_BLOCK && ret == 0)
+    {
+        ret = gc_step(pool, PAGE_PER_BLOCK);
+    }
+
+    STAT_ADD(gc_stat.time_ns, ssd_clock_ns() - start);
+
+    return ret;
+}
+
+/*
+ * Run after every host page while a victim is being reclaimed. The
+ * copies are spread evenly over the host pages the frontier has left
+ * besides them, N pages per step with N growing as that headroom shrinks.
+ */
+static int gc_background(BLOCK_POOL* pool)
+{
+    unsigned int headroom, valid;
+    unsigned long long start;
+    int ret;
+
+    if (pool->gc_victim == OUT_OF_BLOCK)
+    {
+        return 0;
+    }
+
+    valid = block_state[pool->gc_victim].valid_count;
+    headroom = __builtin_popcount(block_state[pool->curr_pca.nand].free) - valid;
+
+    start = ssd_clock_ns();
+    ret = gc_step(pool, DIV_ROUND_UP(valid, headroom + 1));
+    STAT_ADD(gc_stat.time_ns, ssd_clock_ns() - start);
+
+    return ret;
+}
+
+static void slc_release(unsigned int blockid)
+{
+    nand_erase(blockid);
+    slc_pool->free_block_number++;
+    if (slc_pool->curr_pca.pca != INVALID_PCA && slc_pool->curr_pca.nand == blockid)
+    {
+        slc_pool->curr_pca.pca = INVALID_PCA;
+    }
+}
+
+static int fold_page_cmp(const void* a, const void* b)
+{
+    unsigned int x = ((const FOLD_PAGE*)a)->lba.lba;
+    unsigned int y = ((const FOLD_PAGE*)b)->lba.lba;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Fold one batch. The valid pages of the oldest full SLC blocks, up to
+ * FOLD_BATCH_PAGES, are read back, sorted by LBA and programmed into
+ * the pools of their namespaces, as many at once as the frontier takes.
+ * Full SLC blocks left without valid pages are erased.
+ * Return the number of pages folded or lost plus blocks erased, or -1.
+ */
+static int slc_fold(void)
+{
+    FOLD_PAGE pages[FOLD_BATCH_PAGES];
+    char* prog_buf = &fold_buf[FOLD_BATCH_PAGES * PAGESIZE];
+    unsigned int start, count, done, lost, erased;
+    PCA_RULE pca, lost_pca;
+    NAND_BAD bad;
+
+    // Blocks are opened round-robin, so the oldest follows the frontier
+    start = slc_pool->curr_pca.pca == INVALID_PCA ? 0 : slc_pool->curr_pca.nand + 1;
+
+    bad.buf = fold_buf;
+    bad.mask = 0;
+    count = 0;
+    for (int i = 0; i < PHYSICAL_NAND_NUM && count < FOLD_BATCH_PAGES; i++)
+    {
+        unsigned int blockid = (start + i) % PHYSICAL_NAND_NUM;
+        unsigned int valid, take;
+
+        if (&pools[block_owner[blockid]] != slc_pool ||
+            block_state[blockid].state == FREE_BLOCK || block_state[blockid].free)
+        {
+            continue;
+        }
+
+        valid = ~block_state[blockid].stale & ((1 << SLC_PAGE_PER_BLOCK) - 1);
+        take = 0;
+        while (valid && count + __builtin_popcount(take) < FOLD_BATCH_PAGES)
+        {
+            take |= valid & -valid;
+            valid &= valid - 1;
+        }
+        if (!take)
+        {
+            continue;
+        }
+
+        if (nand_read_mask(&fold_buf[count * PAGESIZE], blockid, take, &bad) <= 0)
+        {
+            return -1;
+        }
+        while (take)
+        {
+            pages[count].pca.nand = blockid;
+            pages[count].pca.pidx = ffs(take) - 1;
+            pages[count].lba = P2L[PCA_ADDR(pages[count].pca)];
+            pages[count].buf = count;
+            count++;
+            take &= take - 1;
+        }
+    }
+
+    if (nand_wait() < 0)
+    {
+        return -1;
+    }
+
+    // A page failing its CRC32C is lost rather than left to pin its block
+    lost_pca.pca = BAD_PCA;
+    lost = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (bad.mask & (1u << pages[i].buf))
+        {
+            printf("fold lost lba %#x at nand_%u page %u\n", pages[i].lba.lba,
+                   pages[i].pca.nand, pages[i].pca.pidx);
+            page_move(pages[i].pca, lost_pca);
+            STAT_ADD(gc_stat.lost_pages, 1);
+            lost++;
+            continue;
+        }
+        pages[i - lost] = pages[i];
+    }
+    count -= lost;
+
+    qsort(pages, count, sizeof(FOLD_PAGE), fold_page_cmp);
+
+    done = 0;
+    while (done < count)
+    {
+        BLOCK_POOL* pool = ns_table[pages[done].lba.nsid].pool;
+        unsigned int room, run;
+
+        pca.pca = get_next_pca(pool);
+        if (pca.pca == OUT_OF_BLOCK)
+        {
+            break;
+        }
+
+        // get_next_pca() keeps room for the rest of a GC victim
+        room = __builtin_popcount(block_state[pca.nand].free);
+        if (pool->gc_victim != OUT_OF_BLOCK)
+        {
+            room -= block_state[pool->gc_victim].valid_count;
+        }
+        for (run = 1; run < room && done + run < count; run++)
+        {
+            if (ns_table[pages[done + run].lba.nsid].pool != pool)
+            {
+                break;
+            }
+        }
+
+        for (int i = 0; i < run; i++)
+        {
+            PCA_RULE dest_pca = pca;
+
+            dest_pca.pidx += i;
+            memcpy(&prog_buf[(done + i) * PAGESIZE], &fold_buf[pages[done + i].buf * PAGESIZE],
+                   PAGESIZE);
+            page_move(pages[done + i].pca, dest_pca);
+        }
+        // Programs go out from prog_buf, each run keeps its part until nand_wait()
+        nand_write_pages(&prog_buf[done * PAGESIZE], pca.pca, run);
+
+        slc_stat.fold_programs++;
+        slc_stat.fold_pages += run;
+        done += run;
+
+        if (gc_background(pool) == -EIO)
+        {
+            break;
+        }
+    }
+
+    if (nand_wait() < 0)
+    {
+        return -1;
+    }
+
+    erased = 0;
+    for (int i = 0; i < PHYSICAL_NAND_NUM; i++)
+    {
+        if (&pools[block_owner[i]] == slc_pool && block_state[i].state != FREE_BLOCK &&
+            !block_state[i].free && !block_state[i].valid_count)
+        {
+            slc_release(i);
+            erased++;
+        }
+    }
+
+    return done + lost + erased;
+}
+
+/*
+ * Fold in the background, one batch per turn so host requests get in
+ * between. It runs while more than fold_low SLC blocks are full, once
+ * fold_high of them are or the host has been idle for FOLD_IDLE_MS.
+ */
+static void* slc_fold_thread(void* arg)
+{
+    struct timespec ts;
+    unsigned int full;
+    NAND_REQ req = {0};
+    int idle;
+
+    (void) arg;
+
+    nand_req = &req;
+    while (1)
+    {
+        pthread_rwlock_rdlock(&ssd_lock);
+        pthread_mutex_lock(&slc_pool->lock);
+        full = slc_full_blocks();
+        idle = ssd_clock_ns() - host_write_ns >= FOLD_IDLE_MS * 1000000ULL;
+
+        if (full > slc_stat.fold_low && (full >= slc_stat.fold_high || idle) &&
+            slc_fold() > 0)
+        {
+            pthread_mutex_unlock(&slc_pool->lock);
+            pthread_rwlock_unlock(&ssd_lock);
+            nand_req_sleep(&req);
+            sched_yield();
+            continue;
+        }
+
+        // Sleep on the SLC pool alone, the namespace table may change
+        pthread_rwlock_unlock(&ssd_lock);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += FOLD_IDLE_MS * 1000000L;
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&fold_cond, &slc_pool->lock, &ts);
+        pthread_mutex_unlock(&slc_pool->lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Started once the frontend is up, after fuse_main() may have daemonized
+ */
+static void slc_fold_start(void)
+{
+    pthread_t thread;
+
+    if (slc_pool && pthread_create(&thread, NULL, slc_fold_thread, NULL) == 0)
+    {
+        pthread_detach(thread);
+    }
+}
+
+/*
+ * Blocks a pool needs to hold capacity pages. A pool must keep one GC
+ * reserve block and one block of headroom on top of the pages it
+ * promised, while in zoned mode every zone simply owns one block.
+ */
+static unsigned int pool_blocks_needed(unsigned int capacity)
+{
+    return DIV_ROUND_UP(capacity, PAGE_PER_BLOCK) + (options.zoned ? 0 : 2);
+}
+
+/*
+ * Move blocks free blocks out of the shared pool into a new pool
+ */
+static int ssd_pool_create(unsigned int blocks, unsigned int capacity,
+                           unsigned int pages_per_block)
+{
+    BLOCK_POOL* shared = &pools[SHARED_POOL];
+    BLOCK_POOL* pool;
+    unsigned int taken;
+
+    if (pool_number == MAX_POOL_NUM)
+    {
+        return -ENOSPC;
+    }
+
+    if (shared->free_block_number < blocks + (options.zoned ? 0 : 1) ||
+        shared->block_number - blocks < pool_blocks_needed(shared->capacity))
+    {
+        return -ENOSPC;
+    }
+
+    pool = &pools[pool_number];
+    pool->curr_pca.pca = INVALID_PCA;
+    pool->gc_victim = OUT_OF_BLOCK;
+    pool->block_number = blocks;
+    pool->free_block_number = blocks;
+    pool->capacity = capacity;
+    pool->pages_per_block = pages_per_block;
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->gc_buf = malloc(PAGESIZE * PAGE_PER_BLOCK);
+
+    taken = 0;
+    for (int i = 0; i < PHYSICAL_NAND_NUM && taken < blocks; i++)
+    {
+        if (block_owner[i] != SHARED_POOL || block_state[i].state != FREE_BLOCK)
+        {
+            continue;
+        }
+
+        block_owner[i] = pool_number;
+        taken++;
+    }
+
+    shared->block_number -= blocks;
+    shared->free_block_number -= blocks;
+
+    return pool_number++;
+}
+
+/*
+ * Take blocks blocks for the SLC write cache, folding starts once they
+ * are all full by default
+ */
+static int ssd_slc_create(unsigned int blocks)
+{
+    int poolid;
+
+    if (options.zoned)
+    {
+        return -EINVAL;
+    }
+
+    poolid = ssd_pool_create(blocks, 0, SLC_PAGE_PER_BLOCK);
+    if (poolid < 0)
+    {
+        return poolid;
+    }
+
+    slc_pool = &pools[poolid];
+    slc_stat.fold_low = 0;
+    slc_stat.fold_high = blocks;
+    fold_buf = malloc(2 * FOLD_BATCH_PAGES * PAGESIZE);
+
+    return 0;
+}
+
+/*
+ * Return a free slot of ns_table, or -ENOSPC
+ */
+static int ssd_ns_alloc(void)
+{
+    for (int i = 0; i < ns_number; i++)
+    {
+        if (ns_table[i].name[0] == '\0')
+        {
+            return i;
+        }
+    }
+    if (ns_number == MAX_NS_NUM)
+    {
+        return -ENOSPC;
+    }
+    return ns_number++;
+}
+
+static void ssd_ns_init(SSD_NS* ns)
+{
+    ns->generation++;
+    ns->origin = NULL;
+    ns->snapshot_seq = 0;
+    ns->zones = NULL;
+    ns->zone_number = 0;
+    memset(&ns->stat, 0, sizeof(ns->stat));
+    ns->ra = NULL;
+}
+
+/*
+ * Create a namespace of size bytes. blocks == 0 binds it to the shared
+ * pool, otherwise it gets a dedicated pool of that many blocks so its
+ * GC never runs on behalf of another namespace.
+ */
+static int ssd_ns_create(size_t size, unsigned int blocks)
+{
+    SSD_NS* ns;
+    unsigned int pages;
+    int poolid, nsid;
+
+    // The slot stays free, name empty, until the namespace is set up
+    nsid = ssd_ns_alloc();
+    if (nsid < 0)
+    {
+        return nsid;
+    }
+
+    pages = DIV_ROUND_UP(size, PAGESIZE);
+    if (pages == 0)
+    {
+        return -EINVAL;
+    }
+    if (options.zoned)
+    {
+        pages = DIV_ROUND_UP(pages, PAGE_PER_BLOCK) * PAGE_PER_BLOCK;
+    }
+
+    if (blocks)
+    {
+        if (blocks < pool_blocks_needed(pages))
+        {
+            return -EINVAL;
+        }
+        poolid = ssd_pool_create(blocks, pages, PAGE_PER_BLOCK);
+        if (poolid < 0)
+        {
+            return poolid;
+        }
+    }
+    else
+    {
+        poolid = SHARED_POOL;
+        if (pools[poolid].block_number < pool_blocks_needed(pools[poolid].capacity + pages))
+        {
+            return -ENOSPC;
+        }
+        pools[poolid].capacity += pages;
+    }
+
+    ns = &ns_table[nsid];
+    if (nsid == 0)
+    {
+        snprintf(ns->name, sizeof(ns->name), SSD_NAME);
+    }
+    else
+    {
+        snprintf(ns->name, sizeof(ns->name), SSD_NAME "%u", nsid);
+    }
+    ssd_ns_init(ns);
+    ns->logic_size = 0;
+    ns->capacity = (size_t)pages * PAGESIZE;
+    ns->pool = &pools[poolid];
+
+    // A zoned namespace has no L2P, its whole size is always visible
+    if (options.zoned)
+    {
+        ns->logic_size = ns->capacity;
+        ns->zone_number = pages / PAGE_PER_BLOCK;
+        ns->zones = malloc(ns->zone_number * sizeof(ZONE));
+        for (int i = 0; i < ns->zone_number; i++)
+        {
+            ns->zones[i].state = SSD_ZONE_EMPTY;
+            ns->zones[i].wp = 0;
+            ns->zones[i].written = 0;
+            ns->zones[i].blockid = OUT_OF_BLOCK;
+        }
+        return nsid;
+    }
+
+    ns->L2P = malloc(DIV_ROUND_UP(pages, L2P_CHUNK_PAGES) * sizeof(L2P_CHUNK*));
+    for (int i = 0; i < DIV_ROUND_UP(pages, L2P_CHUNK_PAGES); i++)
+    {
+        ns->L2P[i] = malloc(sizeof(L2P_CHUNK));
+        ns->L2P[i]->ref = 1;
+        memset(ns->L2P[i]->pca, INVALID_PCA, sizeof(ns->L2P[i]->pca));
+    }
+
+    return nsid;
+}
+
+/*
+ * Freeze the L2P table of ns into a new read-only namespace. The
+ * chunks are shared, later writes to ns copy the chunk they touch.
+ */
+static int ssd_snapshot_create(SSD_NS* ns, struct ssd_snapshot* snap)
+{
+    SSD_NS* snapns;
+    int nsid;
+
+    if (options.zoned)
+    {
+        return -EOPNOTSUPP;
+    }
+    if (ns->origin)
+    {
+        return -EINVAL;
+    }
+
+    nsid = ssd_ns_alloc();
+    if (nsid < 0)
+    {
+        return nsid;
+    }
+
+    snapns = &ns_table[nsid];
+    ssd_ns_init(snapns);
+    snprintf(snapns->name, sizeof(snapns->name), "%.16s.snap%u",
+             ns->name, ns->snapshot_seq++);
+    snapns->origin = ns;
+    snapns->logic_size = ns->logic_size;
+    snapns->capacity = ns->capacity;
+    snapns->pool = ns->pool;
+    snapns->L2P = malloc(DIV_ROUND_UP(ns->capacity / PAGESIZE, L2P_CHUNK_PAGES) * sizeof(L2P_CHUNK*));
+    for (int i = 0; i < DIV_ROUND_UP(ns->capacity / PAGESIZE, L2P_CHUNK_PAGES); i++)
+    {
+        snapns->L2P[i] = ns->L2P[i];
+        snapns->L2P[i]->ref++;
+    }
+
+    snap->nsid = nsid;
+    snprintf(snap->name, sizeof(snap->name), "%s", snapns->name);
+
+    return 0;
+}
+
+/*
+ * Release the chunks of a snapshot, pages only it still maps become stale
+ */
+static int ssd_snapshot_delete(SSD_NS* snapns)
+{
+    if (!snapns->origin)
+    {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < DIV_ROUND_UP(snapns->capacity / PAGESIZE, L2P_CHUNK_PAGES); i++)
+    {
+        l2p_chunk_put(snapns->L2P[i]);
+    }
+    free(snapns->L2P);
+    snapns->L2P = NULL;
+
+    snapns->name[0] = '\0';
+    snapns->origin = NULL;
+
+    return 0;
+}
+
+/*
+ * Give an empty zone its block
+ */
+static int zns_zone_activate(SSD_NS* ns, ZONE* zone)
+{
+    PCA_RULE pca;
+
+    if (zone->blockid != OUT_OF_BLOCK)
+    {
+        return 0;
+    }
+
+    pca.pca = get_next_block(ns->pool);
+    if (pca.pca == OUT_OF_BLOCK)
+    {
+        return -ENOSPC;
+    }
+
+    zone->blockid = pca.nand;
+    return 0;
+}
+
+/*
+ * Erase the block of a zone and give it back to the pool
+ */
+static void zns_zone_release(SSD_NS* ns, ZONE* zone)
+{
+    if (zone->blockid != OUT_OF_BLOCK)
+    {
+        nand_erase(zone->blockid);
+        ns->pool->free_block_number++;
+    }
+
+    zone->state = SSD_ZONE_EMPTY;
+    zone->wp = 0;
+    zone->written = 0;
+    zone->blockid = OUT_OF_BLOCK;
+}
+
+/*
+ * Read of a zoned namespace, pages past what a zone programmed read as zeros
+ */
+static int zns_do_read(SSD_NS* ns, char* buf, size_t size, off_t offset)
+{
+    int tmp_lba, tmp_lba_range;
+    int idx, curr_size;
+    char* tmp_buf;
+
+    if (offset >= ns->logic_size)
+    {
+        return 0;
+    }
+    if (size > ns->logic_size - offset)
+    {
+        size = ns->logic_size - offset;
+    }
+
+    tmp_lba = offset / PAGESIZE;
+    tmp_lba_range = (offset + size - 1) / PAGESIZE - (tmp_lba) + 1;
+    tmp_buf = calloc(tmp_lba_range * PAGESIZE, sizeof(char));
+
+    //One backing read per zone
+    idx = 0;
+    while (idx < tmp_lba_range)
+    {
+        ZONE* zone;
+        PCA_RULE pca;
+        int pidx, run, valid;
+
+        zone = &ns->zones[(tmp_lba + idx) / PAGE_PER_BLOCK];
+        pidx = (tmp_lba + idx) % PAGE_PER_BLOCK;
+        run = PAGE_PER_BLOCK - pidx;
+        if (run > tmp_lba_range - idx)
+        {
+            run = tmp_lba_range - idx;
+        }
+
+        valid = zone->written > pidx ? zone->written - pidx : 0;
+        if (valid > run)
+        {
+            valid = run;
+        }
+        if (valid)
+        {
+            pca.nand = zone->blockid;
+            pca.pidx = pidx;
+            nand_read_pages(&tmp_buf[idx * PAGESIZE], pca.pca, valid, NULL);
+        }
+
+        idx += run;
+    }
+
+    if (nand_wait() < 0)
+    {
+        free(tmp_buf);
+        return -EIO;
+    }
+
+    curr_size = size;
+    memcpy(buf, &tmp_buf[offset % PAGESIZE], curr_size);
+    free(tmp_buf);
+
+    return curr_size;
+}
+
+/*
+ * Write of a zoned namespace. It must start at the write pointer of a
+ * zone and stay inside it. A partial last page is padded with zeros.
+ */
+static int zns_do_write(SSD_NS* ns, const char* buf, size_t size, off_t offset)
+{
+    ZONE* zone;
+    PCA_RULE pca;
+    char* tmp_buf;
+    int idx, pages, ret;
+
+    if (offset % PAGESIZE || offset >= ns->capacity)
+    {
+        return -EINVAL;
+    }
+
+    zone = &ns->zones[offset / ZONE_SIZE];
+    if (zone->state == SSD_ZONE_FULL || offset % ZONE_SIZE != zone->wp * PAGESIZE)
+    {
+        return -EIO;
+    }
+    if (offset % ZONE_SIZE + size > ZONE_SIZE)
+    {
+        return -EINVAL;
+    }
+
+    ret = zns_zone_activate(ns, zone);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    STAT_ADD(host_write_size, size);
+    ns->stat.host_write_size += size;
+
+    pages = DIV_ROUND_UP(size, PAGESIZE);
+    tmp_buf = calloc(PAGESIZE, sizeof(char));
+    pca.nand = zone->blockid;
+
+    for (idx = 0; idx < pages; idx++)
+    {
+        const char* page = &buf[idx * PAGESIZE];
+
+        if ((idx + 1) * PAGESIZE > size)
+        {
+            memcpy(tmp_buf, page, size - idx * PAGESIZE);
+            page = tmp_buf;
+        }
+
+        pca.pidx = zone->wp++;
+        P2L[PCA_ADDR(pca)].nsid = ns - ns_table;
+        P2L[PCA_ADDR(pca)].lidx = offset / PAGESIZE + idx;
+        nand_write(page, pca.pca);
+        ns->stat.nand_write_size += PAGESIZE;
+    }
+    zone->written = zone->wp;
+
+    if (zone->wp == PAGE_PER_BLOCK)
+    {
+        zone->state = SSD_ZONE_FULL;
+    }
+    else if (zone->state != SSD_ZONE_EXP_OPEN)
+    {
+        zone->state = SSD_ZONE_IMP_OPEN;
+    }
+
+    ret = nand_wait();
+    free(tmp_buf);
+
+    return ret < 0 ? ret : size;
+}
+
+/*
+ * Zone management commands, zoneid indexes the zones of ns
+ */
+static int zns_zone_mgmt(SSD_NS* ns, unsigned int cmd, unsigned int zoneid)
+{
+    ZONE* zone;
+    int ret;
+
+    if (!options.zoned)
+    {
+        return -EOPNOTSUPP;
+    }
+    if (zoneid >= ns->zone_number)
+    {
+        return -EINVAL;
+    }
+    zone = &ns->zones[zoneid];
+
+    switch (cmd)
+    {
+        case SSD_ZONE_OPEN:
+            if (zone->state == SSD_ZONE_FULL)
+            {
+                return -EINVAL;
+            }
+            ret = zns_zone_activate(ns, zone);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            zone->state = SSD_ZONE_EXP_OPEN;
+            return 0;
+        case SSD_ZONE_CLOSE:
+            if (zone->state == SSD_ZONE_EMPTY || zone->state == SSD_ZONE_FULL)
+            {
+                return -EINVAL;
+            }
+            if (zone->wp == 0)
+            {
+                zns_zone_release(ns, zone);
+                return 0;
+            }
+            zone->state = SSD_ZONE_CLOSED;
+            return 0;
+        case SSD_ZONE_FINISH:
+            zone->state = SSD_ZONE_FULL;
+            zone->wp = PAGE_PER_BLOCK;
+            return 0;
+        case SSD_ZONE_RESET:
+            zns_zone_release(ns, zone);
+            return 0;
+    }
+    return -EINVAL;
+}
+
+static int zns_zone_report(SSD_NS* ns, struct ssd_zone_report* report)
+{
+    if (!options.zoned)
+    {
+        return -EOPNOTSUPP;
+    }
+
+    memset(report, 0, sizeof(*report));
+    report->nr_zones = ns->zone_number;
+    report->zone_size = ZONE_SIZE;
+    for (int i = 0; i < ns->zone_number; i++)
+    {
+        report->zones[i].start = (size_t)i * ZONE_SIZE;
+        report->zones[i].wp = report->zones[i].start + ns->zones[i].wp * PAGESIZE;
+        report->zones[i].state = ns->zones[i].state;
+    }
+    return 0;
+}
+
+/*
+ * Parse the --ns=SIZE_KB[:BLOCKS][,SIZE_KB[:BLOCKS]...] mount option
+ */
+static int ssd_ns_parse(const char* spec)
+{
+    char* str, *tok, *saveptr;
+    int ret = 0;
+
+    str = strdup(spec);
+
+    for (tok = strtok_r(str, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr))
+    {
+        unsigned long size_kb, blocks = 0;
+        char* endp;
+
+        size_kb = strtoul(tok, &endp, 0);
+        if (*endp == ':')
+        {
+            blocks = strtoul(endp + 1, &endp, 0);
+        }
+        if (endp == tok || *endp != '\0')
+        {
+            ret = -EINVAL;
+            break;
+        }
+
+        ret = ssd_ns_create(size_kb * 1024, blocks);
+        if (ret < 0)
+        {
+            break;
+        }
+    }
+
+    free(str);
+
+    return ret < 0 ? ret : 0;
+}
+
+static SSD_NS* ssd_ns_lookup(const char* path)
+{
+    if (path[0] != '/')
+    {
+        return NULL;
+    }
+    for (int i = 0; i < ns_number; i++)
+    {
+        if (ns_table[i].name[0] && strcmp(path + 1, ns_table[i].name) == 0)
+        {
+            return &ns_table[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Look up path along with the generation of its namespace, for a
+ * request to check with ssd_ns_valid() once it holds ssd_lock
+ */
+static SSD_NS* ssd_ns_get(const char* path, unsigned int* generation)
+{
+    SSD_NS* ns;
+
+    pthread_rwlock_rdlock(&ssd_lock);
+    ns = ssd_ns_lookup(path);
+    if (ns)
+    {
+        *generation = ns->generation;
+    }
+    pthread_rwlock_unlock(&ssd_lock);
+
+    return ns;
+}
+
+/*
+ * Pool lock of the requests on ns. Every host write goes through the
+ * SLC cache when there is one, which then covers all namespaces.
+ */
+static pthread_mutex_t* ssd_ns_lock(SSD_NS* ns)
+{
+    return &(slc_pool ? slc_pool : ns->pool)->lock;
+}
+
+/*
+ * With ssd_lock held, check that ns is still the namespace a request
+ * looked up: a snapshot may have been deleted, and its slot reused.
+ */
+static int ssd_ns_valid(SSD_NS* ns, unsigned int generation)
+{
+    return ns->name[0] && ns->generation == generation;
+}
+
+/*
+ * Start a request on ns, issuing its NAND commands for req. Fails with
+ * -ENOENT if ns is no longer the namespace the request looked up.
+ */
+static int ssd_ns_enter(SSD_NS* ns, unsigned int generation, NAND_REQ* req)
+{
+    pthread_rwlock_rdlock(&ssd_lock);
+    if (!ssd_ns_valid(ns, generation))
+    {
+        pthread_rwlock_unlock(&ssd_lock);
+        return -ENOENT;
+    }
+    pthread_mutex_lock(ssd_ns_lock(ns));
+
+    memset(req, 0, sizeof(NAND_REQ));
+    nand_req = req;
+    return 0;
+}
+
+/*
+ * End the request, then wait out the NAND time it was charged without
+ * holding up other requests
+ */
+static void ssd_ns_exit(SSD_NS* ns)
+{
+    NAND_REQ* req = nand_req;
+
+    nand_req = NULL;
+    pthread_mutex_unlock(ssd_ns_lock(ns));
+    pthread_rwlock_unlock(&ssd_lock);
+    nand_req_sleep(req);
+}
+
+/*
+ * Open ns for the host, its read stream starts out not sequential
+ */
+static SSD_FH* ssd_fh_open(SSD_NS* ns)
+{
+    SSD_FH* fh;
+
+    fh = calloc(1, sizeof(SSD_FH));
+    fh->ns = ns;
+    fh->ra.buf = malloc(RA_MAX_PAGES * PAGESIZE);
+
+    pthread_rwlock_rdlock(&ssd_lock);
+    pthread_mutex_lock(ssd_ns_lock(ns));
+    fh->generation = ns->generation;
+    fh->ra.next = ns->ra;
+    ns->ra = &fh->ra;
+    pthread_mutex_unlock(ssd_ns_lock(ns));
+    pthread_rwlock_unlock(&ssd_lock);
+
+    return fh;
+}
+
+/*
+ * Close an open file. A deleted snapshot no longer lists its stream,
+ * and its slot may list those of the namespace that reused it.
+ */
+static void ssd_fh_release(SSD_FH* fh)
+{
+    pthread_rwlock_rdlock(&ssd_lock);
+    pthread_mutex_lock(ssd_ns_lock(fh->ns));
+
+    // A readahead may still be filling the buffer
+    if (fh->ra.pending)
+    {
+        nand_req_drain(&fh->ra.req);
+    }
+    for (SSD_RA** ra = &fh->ns->ra; *ra; ra = &(*ra)->next)
+    {
+        if (*ra == &fh->ra)
+        {
+            *ra = fh->ra.next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(ssd_ns_lock(fh->ns));
+    pthread_rwlock_unlock(&ssd_lock);
+
+    free(fh->ra.buf);
+    free(fh);
+}
+
+static int ssd_file_type(const char* path)
+{
+    if (strcmp(path, "/") == 0)
+    {
+        return SSD_ROOT;
+    }
+    if (ssd_ns_lookup(path))
+    {
+        return SSD_FILE;
+    }
+    return SSD_NONE;
+}
+
+static unsigned long long ssd_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Fill stbuf for the namespace file ns, or for the root when ns is NULL
+ */
+static void ssd_fill_stat(SSD_NS* ns, struct stat* stbuf)
+{
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+    stbuf->st_atime = stbuf->st_mtime = time(NULL);
+    if (!ns)
+    {
+        stbuf->st_ino = FUSE_ROOT_ID;
+        stbuf->st_mode = S_IFDIR | 0755;
+        stbuf->st_nlink = 2;
+    }
+    else
+    {
+        stbuf->st_ino = NS_INO(ns - ns_table);
+        stbuf->st_mode = ns->origin ? S_IFREG | 0444 : S_IFREG | 0644;
+        stbuf->st_nlink = 1;
+        pthread_rwlock_rdlock(&ssd_lock);
+        pthread_mutex_lock(ssd_ns_lock(ns));
+        stbuf->st_size = ns->logic_size;
+        pthread_mutex_unlock(ssd_ns_lock(ns));
+        pthread_rwlock_unlock(&ssd_lock);
+    }
+}
+
+static int ssd_getattr(const char* path, struct stat* stbuf,
+                       struct fuse_file_info* fi)
+{
+    SSD_NS* ns;
+    unsigned int generation;
+
+    (void) fi;
+    if (ssd_file_type(path) == SSD_ROOT)
+    {
+        ssd_fill_stat(NULL, stbuf);
+        return 0;
+    }
+    ns = ssd_ns_get(path, &generation);
+    if (!ns)
+    {
+        return -ENOENT;
+    }
+    ssd_fill_stat(ns, stbuf);
+    return 0;
+}
+
+static int ssd_open(const char* path, struct fuse_file_info* fi)
+{
+    SSD_NS* ns;
+    unsigned int generation;
+
+    ns = ssd_ns_get(path, &generation);
+    if (ns && ns->origin && (fi->flags & O_ACCMODE) != O_RDONLY)
+    {
+        return -EROFS;
+    }
+    if (ssd_file_type(path) != SSD_NONE)
+    {
+        // Zone writes must reach the device unsplit and in order
+        fi->direct_io = options.zoned;
+        fi->fh = ns ? (uintptr_t)ssd_fh_open(ns) : 0;
+        return 0;
     }
     return -ENOENT;
 }
 
-static int ssd_do_read(char* buf, size_t size, off_t offset)
+static int ssd_release(const char* path, struct fuse_file_info* fi)
 {
-    int tmp_lba;
-    int idx, curr_size, remain_size;
+    (void) path;
+    if (fi->fh)
+    {
+        ssd_fh_release((SSD_FH*)(uintptr_t)fi->fh);
+    }
+    return 0;
+}
+
+#define RA_HIT(ra, lba) ((ra) && (lba) >= (ra)->start && (lba) < (ra)->start + (ra)->count && \
+                         !((ra)->bad.mask & (1u << ((lba) - (ra)->start))))
+
+/*
+ * Called after the read [offset, offset + size) of ns through the
+ * stream ra completed. A read starting where the previous one ended is
+ * sequential: the window starts at twice the request (at least
+ * RA_MIN_PAGES) and doubles up to RA_MAX_PAGES each time it is
+ * refilled. The refill is submitted without waiting once less than
+ * half a window is buffered ahead of the stream. Any other read resets
+ * the stream. A prefetched page failing its check only fails the read
+ * that later asks for it.
+ */
+static void ssd_readahead(SSD_NS* ns, SSD_RA* ra, off_t offset, size_t size)
+{
+    unsigned int end, last, keep;
+    NAND_REQ* req;
+
+    if (offset != ra->next_offset)
+    {
+        ra->next_offset = offset + size;
+        ra->window = 0;
+        ra->count = 0;
+        return;
+    }
+    ra->next_offset = offset + size;
+
+    //The page holding next_offset is the first one the stream needs
+    end = (offset + size) / PAGESIZE;
+    keep = 0;
+    if (ra->count && end >= ra->start && end < ra->start + ra->count)
+    {
+        keep = ra->start + ra->count - end;
+    }
+    if (ra->window && keep >= ra->window / 2)
+    {
+        return;
+    }
+
+    if (ra->window == 0)
+    {
+        ra->window = 2 * DIV_ROUND_UP(size, PAGESIZE);
+        if (ra->window < RA_MIN_PAGES)
+        {
+            ra->window = RA_MIN_PAGES;
+        }
+    }
+    else
+    {
+        ra->window *= 2;
+    }
+    if (ra->window > RA_MAX_PAGES)
+    {
+        ra->window = RA_MAX_PAGES;
+    }
+
+    last = end + ra->window;
+    if (last > DIV_ROUND_UP(ns->logic_size, PAGESIZE))
+    {
+        last = DIV_ROUND_UP(ns->logic_size, PAGESIZE);
+    }
+    if (end + keep >= last)
+    {
+        return;
+    }
+
+#ifndef SSD_IO_URING
+    // Every command completes as it is submitted, the refill would only
+    // add its pages to the latency of this read
+    return;
+#endif
+
+    memmove(ra->buf, &ra->buf[(ra->count - keep) * PAGESIZE], keep * PAGESIZE);
+    ra->bad.buf = ra->buf;
+    ra->bad.mask = keep ? ra->bad.mask >> (ra->count - keep) : 0;
+    ra->start = end;
+    ra->count = keep;
+
+    // The refill outlives the read, it is a request of its own
+    req = nand_req;
+    nand_req = &ra->req;
+    ra->count += ftl_read_range(ns, &ra->buf[keep * PAGESIZE], end + keep, last - end - keep,
+                                &ra->bad);
+    nand_req = req;
+    ra->pending = 1;
+    ns->stat.readahead_pages += ra->count - keep;
+}
+
+/*
+ * Read of ns through the read stream ra, without readahead if it is NULL
+ */
+static int ssd_do_read(SSD_NS* ns, SSD_RA* ra, char* buf, size_t size, off_t offset)
+{
+    int tmp_lba, tmp_lba_range;
+    int idx, curr_size, ret;
     char* tmp_buf;
 
+    if (options.zoned)
+    {
+        return zns_do_read(ns, buf, size, offset);
+    }
+
     //off limit
-    if (offset >= logic_size)
+    if (offset >= ns->logic_size)
     {
         return 0;
     }
-    if (size > logic_size - offset)
+    if (size > ns->logic_size - offset)
     {
         //is valid data section
-        size = logic_size - offset;
+        size = ns->logic_size - offset;
     }
 
     tmp_lba = offset / PAGESIZE;
-    tmp_buf = calloc(PAGESIZE, sizeof(char));
+    tmp_lba_range = (offset + size - 1) / PAGESIZE - (tmp_lba) + 1;
+    tmp_buf = calloc(tmp_lba_range * PAGESIZE, sizeof(char));
 
-    idx = 0;
-    curr_size = 0;
-    remain_size = size;
+    //Prefetched pages must land before they are used
+    if (ra && ra->pending)
+    {
+        nand_req_drain(&ra->req);
+        ra->pending = 0;
+        if (nand_req->done_ns < ra->req.done_ns)
+        {
+            nand_req->done_ns = ra->req.done_ns;
+        }
+    }
 
-    while (remain_size > 0)
+    //Take pages from the readahead buffer, submit the others
+    idx = 0;
+    while (idx < tmp_lba_range)
     {
-        int ret, rsize;
+        int lba, run;
+
+        lba = tmp_lba + idx;
+        if (RA_HIT(ra, lba))
+        {
+            memcpy(&tmp_buf[idx * PAGESIZE], &ra->buf[(lba - ra->start) * PAGESIZE], PAGESIZE);
+            ns->stat.readahead_hits++;
+            idx++;
+            continue;
+        }
 
-        ret = ftl_read(tmp_buf, tmp_lba + idx);
+        for (run = 1; idx + run < tmp_lba_range && !RA_HIT(ra, lba + run); run++);
 
-        if (ret <= 0)
+        ret = ftl_read_range(ns, &tmp_buf[idx * PAGESIZE], lba, run, NULL);
+        idx += ret;
+        if (ret < run)
         {
             break;
         }
+    }
 
-        offset = (offset + curr_size) % PAGESIZE;
-        rsize = remain_size > PAGESIZE - offset ? PAGESIZE - offset : remain_size;
+    //The request completes when all of its pages do
+    if (nand_wait() < 0)
+    {
+        free(tmp_buf);
+        return -EIO;
+    }
 
-        memcpy(&buf[curr_size], &tmp_buf[offset], rsize);
+    if (ra)
+    {
+        ssd_readahead(ns, ra, offset, size);
+    }
 
-        idx += 1;
-        curr_size += rsize;
-        remain_size -= rsize;
+    offset %= PAGESIZE;
+    curr_size = idx * PAGESIZE - offset;
+    if (curr_size > size)
+    {
+        curr_size = size;
+    }
+    if (curr_size > 0)
+    {
+        memcpy(buf, &tmp_buf[offset], curr_size);
     }
 
     free(tmp_buf);
 
-    return curr_size;
+    return curr_size < 0 ? 0 : curr_size;
+}
+
+static int ssd_ns_read(SSD_NS* ns, unsigned int generation, SSD_RA* ra, char* buf,
+                       size_t size, off_t offset)
+{
+    unsigned long long start, end, lat;
+    NAND_REQ req;
+    int ret;
+
+    ret = ssd_ns_enter(ns, generation, &req);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    start = ssd_clock_ns();
+    ret = ssd_do_read(ns, ra, buf, size, offset);
+    end = ssd_clock_ns();
+
+    // With --timing the request is over once the NAND is done with it
+    lat = (req.done_ns > end ? req.done_ns : end) - start;
+
+    ns->stat.read_count++;
+    ns->stat.read_lat_ns += lat;
+    if (lat > ns->stat.read_lat_max_ns)
+    {
+        ns->stat.read_lat_max_ns = lat;
+    }
+
+    ssd_ns_exit(ns);
+
+    return ret;
 }
 
 static int ssd_read(const char* path, char* buf, size_t size,
                     off_t offset, struct fuse_file_info* fi)
 {
-    (void) fi;
-    if (ssd_file_type(path) != SSD_FILE)
+    SSD_NS* ns;
+    SSD_FH* fh;
+    unsigned int generation;
+
+    fh = fi ? (SSD_FH*)(uintptr_t)fi->fh : NULL;
+    if (fh)
+    {
+        return ssd_ns_read(fh->ns, fh->generation, &fh->ra, buf, size, offset);
+    }
+
+    ns = ssd_ns_get(path, &generation);
+    if (!ns)
     {
         return -EINVAL;
     }
-    return ssd_do_read(buf, size, offset);
+    return ssd_ns_read(ns, generation, NULL, buf, size, offset);
 }
 
-static int ssd_do_write(const char* buf, size_t size, off_t offset)
+static int ssd_do_write(SSD_NS* ns, const char* buf, size_t size, off_t offset)
 {
     int tmp_lba, tmp_lba_range;
     int idx, curr_size, remain_size;
@@ -482,15 +2781,22 @@ static int ssd_do_write(const char* buf, size_t size, off_t offset)
         return 0;
     }
 
-    host_write_size += size;
-    if (ssd_expand(offset + size) != 0)
+    if (options.zoned)
+    {
+        return zns_do_write(ns, buf, size, offset);
+    }
+
+    STAT_ADD(host_write_size, size);
+    ns->stat.host_write_size += size;
+    if (offset + size > ns->capacity)
     {
         return -ENOMEM;
     }
 
     tmp_lba = offset / PAGESIZE;
     tmp_lba_range = (offset + size - 1) / PAGESIZE - (tmp_lba) + 1;
-    tmp_buf = calloc(PAGESIZE, sizeof(char));
+    //Head and tail pages get their own buffer, both may be in flight
+    tmp_buf = calloc(PAGESIZE * 2, sizeof(char));
 
     idx = 0;
     curr_size = 0;
@@ -506,20 +2812,22 @@ static int ssd_do_write(const char* buf, size_t size, off_t offset)
 
         if (wsize != PAGESIZE) {
             //Partial overwrite, need to do read-modify-write
+            char* page_buf = &tmp_buf[idx ? PAGESIZE : 0];
 
-            //Read
-            ret = ftl_read(tmp_buf, tmp_lba + idx);
+            //Read, a failure stays pending for the nand_wait() below
+            ret = ftl_read(ns, page_buf, tmp_lba + idx);
+            nand_drain();
 
-            if (ret <= 0)
+            if (ret <= 0 || nand_req->error < 0)
             {
                 break;
             }
 
             //Modify
-            memcpy(&tmp_buf[off], &buf[curr_size], wsize);
+            memcpy(&page_buf[off], &buf[curr_size], wsize);
 
             //Write
-            ret = ftl_write(tmp_buf, 1, tmp_lba + idx);
+            ret = ftl_write(ns, page_buf, 1, tmp_lba + idx);
 
             if (ret <= 0)
             {
@@ -527,7 +2835,7 @@ static int ssd_do_write(const char* buf, size_t size, off_t offset)
             }
         } else {
             //Just overwrite whole page
-            ret = ftl_write(&buf[curr_size], tmp_lba_range - idx, tmp_lba + idx);
+            ret = ftl_write(ns, &buf[curr_size], tmp_lba_range - idx, tmp_lba + idx);
 
             if (ret <= 0)
             {
@@ -540,39 +2848,184 @@ static int ssd_do_write(const char* buf, size_t size, off_t offset)
         remain_size -= wsize;
     }
 
+    if (nand_wait() < 0 || ret == -EIO)
+    {
+        curr_size = -EIO;
+    }
+    else if (curr_size == 0 && remain_size > 0)
+    {
+        //Snapshots may pin more pages than GC can free
+        curr_size = -ENOSPC;
+    }
+    else
+    {
+        //The file only grows by what a short write got in
+        ssd_expand(ns, offset + curr_size);
+    }
+
     free(tmp_buf);
 
     return curr_size;
 }
 
+static int ssd_ns_write(SSD_NS* ns, unsigned int generation, const char* buf,
+                        size_t size, off_t offset)
+{
+    unsigned long long start, end, lat;
+    NAND_REQ req;
+    int ret, bucket;
+
+    ret = ssd_ns_enter(ns, generation, &req);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if (ns->origin)
+    {
+        ssd_ns_exit(ns);
+        return -EROFS;
+    }
+
+    start = ssd_clock_ns();
+    ret = ssd_do_write(ns, buf, size, offset);
+    end = ssd_clock_ns();
+
+    // With --timing the request is over once the NAND is done with it
+    lat = (req.done_ns > end ? req.done_ns : end) - start;
+
+    ns->stat.write_count++;
+    ns->stat.write_lat_ns += lat;
+    if (lat > ns->stat.write_lat_max_ns)
+    {
+        ns->stat.write_lat_max_ns = lat;
+    }
+
+    // Bucket i holds writes under 2^i us
+    lat /= 1000;
+    bucket = lat ? 64 - __builtin_clzll(lat) : 0;
+    if (bucket >= SSD_LAT_HIST_NUM)
+    {
+        bucket = SSD_LAT_HIST_NUM - 1;
+    }
+    ns->stat.write_lat_hist[bucket]++;
+
+    ssd_ns_exit(ns);
+
+    return ret;
+}
+
 static int ssd_write(const char* path, const char* buf, size_t size,
                      off_t offset, struct fuse_file_info* fi)
 {
+    SSD_NS* ns;
+    unsigned int generation;
+
+    (void) fi;
+    ns = ssd_ns_get(path, &generation);
+    if (!ns)
+    {
+        return -EINVAL;
+    }
+    return ssd_ns_write(ns, generation, buf, size, offset);
+}
+
+/*
+ * Only the namespace being truncated is touched, pages past the new
+ * size are trimmed so other namespaces keep their data. They are only
+ * trimmed once the partial last page has been rewritten, a truncate
+ * that fails leaves the namespace as it was.
+ */
+static int ssd_do_truncate(SSD_NS* ns, off_t size)
+{
+    char* tmp_buf;
+    int ret;
+
+    if (size > ns->capacity)
+    {
+        return -ENOMEM;
+    }
+
+    // A zoned namespace keeps its size, truncating to 0 resets every zone
+    if (options.zoned)
+    {
+        if (size != 0 && size != ns->capacity)
+        {
+            return -EINVAL;
+        }
+        for (int i = 0; size == 0 && i < ns->zone_number; i++)
+        {
+            zns_zone_release(ns, &ns->zones[i]);
+        }
+        return 0;
+    }
+
+    //Zero the tail of the last page so a later expand reads zeros
+    if (size % PAGESIZE && size < ns->logic_size &&
+        L2P_PCA(ns, size / PAGESIZE).pca != INVALID_PCA)
+    {
+        tmp_buf = calloc(PAGESIZE, sizeof(char));
+        ftl_read(ns, tmp_buf, size / PAGESIZE);
+        if (nand_wait() < 0)
+        {
+            free(tmp_buf);
+            return -EIO;
+        }
+        memset(&tmp_buf[size % PAGESIZE], 0, PAGESIZE - size % PAGESIZE);
+        ret = ftl_write(ns, tmp_buf, 1, size / PAGESIZE);
+        if (nand_wait() < 0 || ret < 0)
+        {
+            ret = -EIO;
+        }
+        free(tmp_buf);
+        if (ret <= 0)
+        {
+            //Snapshots may pin more pages than GC can free
+            return ret < 0 ? ret : -ENOSPC;
+        }
+    }
+
+    for (int lba = DIV_ROUND_UP(size, PAGESIZE); lba < ns->capacity / PAGESIZE; lba++)
+    {
+        ftl_trim(ns, lba);
+    }
+
+    return ssd_resize(ns, size);
+}
+
+static int ssd_ns_truncate(SSD_NS* ns, unsigned int generation, off_t size)
+{
+    NAND_REQ req;
+    int ret;
 
-    (void) fi;
-    if (ssd_file_type(path) != SSD_FILE)
+    ret = ssd_ns_enter(ns, generation, &req);
+    if (ret < 0)
     {
-        return -EINVAL;
+        return ret;
+    }
+    if (ns->origin)
+    {
+        ssd_ns_exit(ns);
+        return -EROFS;
     }
-    return ssd_do_write(buf, size, offset);
+    ret = ssd_do_truncate(ns, size);
+    ssd_ns_exit(ns);
+
+    return ret;
 }
 
 static int ssd_truncate(const char* path, off_t size,
                         struct fuse_file_info* fi)
 {
+    SSD_NS* ns;
+    unsigned int generation;
+
     (void) fi;
-    memset(L2P, INVALID_PCA, sizeof(PCA_RULE) * LOGICAL_NAND_NUM * PAGE_PER_BLOCK);
-    memset(P2L, INVALID_LBA, sizeof(int) * PHYSICAL_NAND_NUM * PAGE_PER_BLOCK);
-    memset(block_state, FREE_BLOCK, sizeof(STATE_RULE) * PHYSICAL_NAND_NUM);
-    curr_pca.pca = INVALID_PCA;
-    free_block_number = PHYSICAL_NAND_NUM;
-    gc_blockid = PHYSICAL_NAND_NUM - 1;
-    if (ssd_file_type(path) != SSD_FILE)
+    ns = ssd_ns_get(path, &generation);
+    if (!ns)
     {
         return -EINVAL;
     }
-
-    return ssd_resize(size);
+    return ssd_ns_truncate(ns, generation, size);
 }
 
 static int ssd_readdir(const char* path, void* buf, fuse_fill_dir_t filler,
@@ -588,7 +3041,13 @@ static int ssd_readdir(const char* path, void* buf, fuse_fill_dir_t filler,
     }
     filler(buf, ".", NULL, 0, 0);
     filler(buf, "..", NULL, 0, 0);
-    filler(buf, SSD_NAME, NULL, 0, 0);
+    for (int i = 0; i < ns_number; i++)
+    {
+        if (ns_table[i].name[0])
+        {
+            filler(buf, ns_table[i].name, NULL, 0, 0);
+        }
+    }
     return 0;
 }
 
@@ -599,43 +3058,69 @@ static void debug(void)
 
     printf("%lx / %lx\n", nand_write_size, host_write_size);
 
+    for (int i = 0; i < ns_number; ++i)
+    {
+        if (!ns_table[i].name[0])
+        {
+            continue;
+        }
+        printf("NS_%d | %s | %lx / %lx | POOL_%ld\n", i, ns_table[i].name,
+               ns_table[i].stat.nand_write_size,
+               ns_table[i].stat.host_write_size,
+               ns_table[i].pool - pools);
+    }
+
     for (int i = 0; i < PHYSICAL_NAND_NUM; ++i)
     {
         if (block_state[i].state == FREE_BLOCK)
         {
-            printf("NAND_%d | Invalid\n", i);
+            printf("NAND_%d | POOL_%d | Invalid\n", i, block_owner[i]);
         }
         else
         {
-            printf("NAND_%d | V: %d | F: %0#8x | S: %0#8x\n", i,
+            printf("NAND_%d | POOL_%d | V: %d | F: %0#8x | S: %0#8x\n", i,
+                   block_owner[i],
                    block_state[i].valid_count,
                    block_state[i].free,
                    block_state[i].stale);
         }
     }
 
-    printf("GC: NAND_%d\n", gc_blockid);
+    for (int i = 0; i < pool_number; ++i)
+    {
+        printf("POOL_%d | Free: %d | GC: NAND_%d\n", i,
+               pools[i].free_block_number, pools[i].gc_victim);
+    }
 
     printf("[DEBUG END]\n");
 }
 #endif
 
-static int ssd_ioctl(const char* path, unsigned int cmd, void* arg,
-                     struct fuse_file_info* fi, unsigned int flags, void* data)
+static int ssd_slc_set_fold(const struct ssd_slc_fold* fold)
 {
-
-    if (ssd_file_type(path) != SSD_FILE)
+    if (!slc_pool)
     {
-        return -EINVAL;
+        return -EOPNOTSUPP;
     }
-    if (flags & FUSE_IOCTL_COMPAT)
+    if (fold->fold_low >= fold->fold_high || fold->fold_high > slc_pool->block_number)
     {
-        return -ENOSYS;
+        return -EINVAL;
     }
+
+    slc_stat.fold_low = fold->fold_low;
+    slc_stat.fold_high = fold->fold_high;
+    pthread_cond_signal(&fold_cond);
+    return 0;
+}
+
+static int ssd_do_ioctl(SSD_NS* ns, unsigned int cmd, void* data)
+{
+    int ret;
+
     switch (cmd)
     {
         case SSD_GET_LOGIC_SIZE:
-            *(size_t*)data = logic_size;
+            *(size_t*)data = ns->logic_size;
             return 0;
         case SSD_GET_PHYSIC_SIZE:
             *(size_t*)data = physic_size;
@@ -646,48 +3131,574 @@ static int ssd_ioctl(const char* path, unsigned int cmd, void* arg,
 #endif
             *(double*)data = (double)nand_write_size / (double)host_write_size;
             return 0;
+        case SSD_NS_CREATE:
+            ret = ssd_ns_create(((struct ssd_ns_create*)data)->size,
+                                ((struct ssd_ns_create*)data)->blocks);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            ((struct ssd_ns_create*)data)->nsid = ret;
+            return 0;
+        case SSD_GET_NS_STAT:
+            ns->stat.logic_size = ns->logic_size;
+            ns->stat.capacity = ns->capacity;
+            *(struct ssd_ns_stat*)data = ns->stat;
+            return 0;
+        case SSD_SNAPSHOT_CREATE:
+            return ssd_snapshot_create(ns, (struct ssd_snapshot*)data);
+        case SSD_SNAPSHOT_DELETE:
+            return ssd_snapshot_delete(ns);
+        case SSD_ZONE_REPORT:
+            return zns_zone_report(ns, (struct ssd_zone_report*)data);
+        case SSD_ZONE_OPEN:
+        case SSD_ZONE_CLOSE:
+        case SSD_ZONE_FINISH:
+        case SSD_ZONE_RESET:
+            return zns_zone_mgmt(ns, cmd, *(unsigned int*)data);
+        case SSD_GET_GC_STAT:
+            *(struct ssd_gc_stat*)data = gc_stat;
+            return 0;
+        case SSD_GET_SLC_STAT:
+            if (!slc_pool)
+            {
+                return -EOPNOTSUPP;
+            }
+            slc_stat.blocks = slc_pool->block_number;
+            slc_stat.pages_per_block = slc_pool->pages_per_block;
+            slc_stat.full_blocks = slc_full_blocks();
+            *(struct ssd_slc_stat*)data = slc_stat;
+            return 0;
+        case SSD_SET_FOLD:
+            return ssd_slc_set_fold((struct ssd_slc_fold*)data);
     }
     return -EINVAL;
 }
 
+static int ssd_ns_ioctl(SSD_NS* ns, unsigned int generation, unsigned int cmd,
+                        void* data)
+{
+    NAND_REQ req = {0};
+    int ret;
+
+    // Namespaces and pools may come and go, every other request waits
+    pthread_rwlock_wrlock(&ssd_lock);
+    if (!ssd_ns_valid(ns, generation))
+    {
+        pthread_rwlock_unlock(&ssd_lock);
+        return -ENOENT;
+    }
+    nand_req = &req;
+    ret = ssd_do_ioctl(ns, cmd, data);
+    nand_req = NULL;
+    pthread_rwlock_unlock(&ssd_lock);
+    nand_req_sleep(&req);
+
+    return ret;
+}
+
+static int ssd_ioctl(const char* path, unsigned int cmd, void* arg,
+                     struct fuse_file_info* fi, unsigned int flags, void* data)
+{
+    SSD_NS* ns;
+    unsigned int generation;
+
+    ns = ssd_ns_get(path, &generation);
+    if (!ns)
+    {
+        return -EINVAL;
+    }
+    if (flags & FUSE_IOCTL_COMPAT)
+    {
+        return -ENOSYS;
+    }
+    return ssd_ns_ioctl(ns, generation, cmd, data);
+}
+
+static void* ssd_init(struct fuse_conn_info* conn, struct fuse_config* cfg)
+{
+    (void) conn;
+    (void) cfg;
+
+    slc_fold_start();
+    return NULL;
+}
+
 static const struct fuse_operations ssd_oper =
 {
+    .init           = ssd_init,
     .getattr        = ssd_getattr,
     .readdir        = ssd_readdir,
     .truncate       = ssd_truncate,
     .open           = ssd_open,
+    .release        = ssd_release,
     .read           = ssd_read,
     .write          = ssd_write,
     .ioctl          = ssd_ioctl,
 };
 
+/*
+ * Low-level frontend: namespaces are addressed by inode, so the hot
+ * path skips the path lookup done by the callbacks above. The inode
+ * of a reused slot gets a new generation, which an open file checks
+ * against the one it was opened with.
+ */
+static SSD_NS* ssd_ll_ns(fuse_ino_t ino)
+{
+    if (ino < NS_INO(0) || ino >= NS_INO(ns_number) || !ns_table[ino - NS_INO(0)].name[0])
+    {
+        return NULL;
+    }
+    return &ns_table[ino - NS_INO(0)];
+}
+
+static void ssd_ll_init(void* userdata, struct fuse_conn_info* conn)
+{
+    (void) userdata;
+
+    conn->max_write = SSD_LL_MAX_IO;
+    conn->max_readahead = SSD_LL_MAX_IO;
+
+    slc_fold_start();
+
+    // Writeback caching is opt-in: a snapshot does not see the dirty
+    // pages the kernel still holds, and a write the FTL fails with
+    // ENOSPC is only reported at fsync() or close(). Zoned namespaces
+    // need writes to reach the zone in order and zone resets to be seen.
+    if (options.writeback && !options.zoned &&
+        (conn->capable & FUSE_CAP_WRITEBACK_CACHE))
+    {
+        conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+    }
+}
+
+static void ssd_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name)
+{
+    struct fuse_entry_param e;
+    char path[64];
+    SSD_NS* ns;
+    unsigned int generation;
+
+    snprintf(path, sizeof(path), "/%s", name);
+    ns = ssd_ns_get(path, &generation);
+    if (parent != FUSE_ROOT_ID || !ns)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    memset(&e, 0, sizeof(e));
+    e.ino = NS_INO(ns - ns_table);
+    e.generation = generation;
+    e.attr_timeout = 1.0;
+    e.entry_timeout = 1.0;
+    ssd_fill_stat(ns, &e.attr);
+
+    fuse_reply_entry(req, &e);
+}
+
+static void ssd_ll_getattr(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info* fi)
+{
+    struct stat stbuf;
+    SSD_NS* ns;
+
+    (void) fi;
+    ns = ssd_ll_ns(ino);
+    if (ino != FUSE_ROOT_ID && !ns)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    memset(&stbuf, 0, sizeof(stbuf));
+    ssd_fill_stat(ns, &stbuf);
+    fuse_reply_attr(req, &stbuf, 1.0);
+}
+
+static void ssd_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr,
+                           int to_set, struct fuse_file_info* fi)
+{
+    struct stat stbuf;
+    SSD_NS* ns;
+    int ret;
+
+    ns = ssd_ll_ns(ino);
+    if (!ns)
+    {
+        fuse_reply_err(req, ino == FUSE_ROOT_ID ? EISDIR : ENOENT);
+        return;
+    }
+
+    if (to_set & FUSE_SET_ATTR_SIZE)
+    {
+        ret = ssd_ns_truncate(ns, fi ? ((SSD_FH*)(uintptr_t)fi->fh)->generation : ns->generation,
+                              attr->st_size);
+        if (ret < 0)
+        {
+            fuse_reply_err(req, -ret);
+            return;
+        }
+    }
+
+    memset(&stbuf, 0, sizeof(stbuf));
+    ssd_fill_stat(ns, &stbuf);
+    fuse_reply_attr(req, &stbuf, 1.0);
+}
+
+static void ssd_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+                           off_t off, struct fuse_file_info* fi)
+{
+    char* buf;
+    size_t len;
+    struct stat stbuf;
+
+    (void) fi;
+    if (ino != FUSE_ROOT_ID)
+    {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    buf = calloc(size, sizeof(char));
+    len = 0;
+    memset(&stbuf, 0, sizeof(stbuf));
+
+    // Entry off + 1 follows entry off: ".", "..", then every namespace
+    for (off_t i = off; i < ns_number + 2; i++)
+    {
+        const char* name;
+        size_t entsize;
+
+        if (i < 2)
+        {
+            name = i == 0 ? "." : "..";
+            stbuf.st_ino = FUSE_ROOT_ID;
+        }
+        else
+        {
+            name = ns_table[i - 2].name;
+            stbuf.st_ino = NS_INO(i - 2);
+            if (!name[0])
+            {
+                continue;
+            }
+        }
+
+        entsize = fuse_add_direntry(req, &buf[len], size - len, name, &stbuf, i + 1);
+        if (entsize > size - len)
+        {
+            break;
+        }
+        len += entsize;
+    }
+
+    fuse_reply_buf(req, buf, len);
+    free(buf);
+}
+
+static void ssd_ll_open(fuse_req_t req, fuse_ino_t ino,
+                        struct fuse_file_info* fi)
+{
+    SSD_NS* ns;
+
+    ns = ssd_ll_ns(ino);
+    if (!ns)
+    {
+        fuse_reply_err(req, ino == FUSE_ROOT_ID ? EISDIR : ENOENT);
+        return;
+    }
+    if (ns->origin && (fi->flags & O_ACCMODE) != O_RDONLY)
+    {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+    fi->fh = (uintptr_t)ssd_fh_open(ns);
+    fi->direct_io = options.zoned;
+    fuse_reply_open(req, fi);
+}
+
+static void ssd_ll_release(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info* fi)
+{
+    (void) ino;
+    ssd_fh_release((SSD_FH*)(uintptr_t)fi->fh);
+    fuse_reply_err(req, 0);
+}
+
+static void ssd_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+                        off_t off, struct fuse_file_info* fi)
+{
+    SSD_NS* ns;
+    SSD_FH* fh;
+    char* buf;
+    int ret;
+
+    ns = ssd_ll_ns(ino);
+    if (!ns)
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    buf = malloc(size);
+    fh = (SSD_FH*)(uintptr_t)fi->fh;
+    ret = ssd_ns_read(ns, fh->generation, &fh->ra, buf, size, off);
+    if (ret < 0)
+    {
+        fuse_reply_err(req, -ret);
+    }
+    else
+    {
+        fuse_reply_buf(req, buf, ret);
+    }
+    free(buf);
+}
+
+static void ssd_ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf,
+                         size_t size, off_t off, struct fuse_file_info* fi)
+{
+    SSD_NS* ns;
+    int ret;
+
+    ns = ssd_ll_ns(ino);
+    if (!ns)
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    ret = ssd_ns_write(ns, ((SSD_FH*)(uintptr_t)fi->fh)->generation, buf, size, off);
+    if (ret < 0)
+    {
+        fuse_reply_err(req, -ret);
+    }
+    else
+    {
+        fuse_reply_write(req, ret);
+    }
+}
+
+static void ssd_ll_ioctl(fuse_req_t req, fuse_ino_t ino, unsigned int cmd,
+                         void* arg, struct fuse_file_info* fi, unsigned flags,
+                         const void* in_buf, size_t in_bufsz, size_t out_bufsz)
+{
+    SSD_NS* ns;
+    char* data;
+    int ret;
+
+    (void) arg;
+    ns = ssd_ll_ns(ino);
+    if (!ns)
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    if (flags & FUSE_IOCTL_COMPAT)
+    {
+        fuse_reply_err(req, ENOSYS);
+        return;
+    }
+
+    // Restricted ioctl: the kernel already sized in/out from cmd
+    data = calloc(_IOC_SIZE(cmd) ? _IOC_SIZE(cmd) : 1, sizeof(char));
+    if (in_bufsz)
+    {
+        memcpy(data, in_buf, in_bufsz < _IOC_SIZE(cmd) ? in_bufsz : _IOC_SIZE(cmd));
+    }
+
+    ret = ssd_ns_ioctl(ns, ((SSD_FH*)(uintptr_t)fi->fh)->generation, cmd, data);
+    if (ret < 0)
+    {
+        fuse_reply_err(req, -ret);
+    }
+    else
+    {
+        fuse_reply_ioctl(req, ret, data, out_bufsz);
+    }
+    free(data);
+}
+
+static const struct fuse_lowlevel_ops ssd_ll_oper =
+{
+    .init           = ssd_ll_init,
+    .lookup         = ssd_ll_lookup,
+    .getattr        = ssd_ll_getattr,
+    .setattr        = ssd_ll_setattr,
+    .readdir        = ssd_ll_readdir,
+    .open           = ssd_ll_open,
+    .release        = ssd_ll_release,
+    .read           = ssd_ll_read,
+    .write          = ssd_ll_write,
+    .ioctl          = ssd_ll_ioctl,
+};
+
+static int ssd_ll_main(struct fuse_args* args)
+{
+    struct fuse_session* se;
+    struct fuse_cmdline_opts opts;
+    struct fuse_loop_config config;
+    char max_read[32];
+    int ret = 1;
+
+    if (fuse_parse_cmdline(args, &opts) != 0)
+    {
+        return 1;
+    }
+    if (opts.show_help || opts.show_version || !opts.mountpoint)
+    {
+        printf("usage: %s [options] <mountpoint>\n", args->argv[0]);
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        goto out;
+    }
+
+    snprintf(max_read, sizeof(max_read), "-omax_read=%d", SSD_LL_MAX_IO);
+    fuse_opt_add_arg(args, max_read);
+
+    se = fuse_session_new(args, &ssd_ll_oper, sizeof(ssd_ll_oper), NULL);
+    if (se == NULL)
+    {
+        goto out;
+    }
+    if (fuse_set_signal_handlers(se) != 0)
+    {
+        goto out_destroy;
+    }
+    if (fuse_session_mount(se, opts.mountpoint) != 0)
+    {
+        goto out_signal;
+    }
+
+    fuse_daemonize(opts.foreground);
+
+    if (opts.singlethread)
+    {
+        ret = fuse_session_loop(se);
+    }
+    else
+    {
+        // libfuse starts workers on demand, this only caps the idle ones
+        config.clone_fd = opts.clone_fd;
+        config.max_idle_threads = opts.max_idle_threads;
+        ret = fuse_session_loop_mt(se, &config);
+    }
+
+    fuse_session_unmount(se);
+out_signal:
+    fuse_remove_signal_handlers(se);
+out_destroy:
+    fuse_session_destroy(se);
+out:
+    free(opts.mountpoint);
+    return ret;
+}
+
 int main(int argc, char* argv[])
 {
-    int idx;
+    int idx, ret;
     char nand_name[100];
+    pthread_rwlockattr_t lock_attr;
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+    // Writer preferring, so a snapshot is not starved by a stream of I/O
+    pthread_rwlockattr_init(&lock_attr);
+    pthread_rwlockattr_setkind_np(&lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&ssd_lock, &lock_attr);
+
     physic_size = 0;
-    logic_size = 0;
-    curr_pca.pca = INVALID_PCA;
-    free_block_number = PHYSICAL_NAND_NUM;
-    gc_blockid = PHYSICAL_NAND_NUM - 1;
-    L2P = malloc(LOGICAL_NAND_NUM * PAGE_PER_BLOCK * sizeof(PCA_RULE));
-    memset(L2P, INVALID_PCA, sizeof(PCA_RULE) * LOGICAL_NAND_NUM * PAGE_PER_BLOCK);
-    P2L = malloc(PHYSICAL_NAND_NUM * PAGE_PER_BLOCK * sizeof(int));
-    memset(P2L, INVALID_LBA, sizeof(int) * PHYSICAL_NAND_NUM * PAGE_PER_BLOCK);
+    P2L = malloc(PHYSICAL_NAND_NUM * PAGE_PER_BLOCK * sizeof(LBA_RULE));
+    memset(P2L, INVALID_LBA, sizeof(LBA_RULE) * PHYSICAL_NAND_NUM * PAGE_PER_BLOCK);
     block_state = malloc(PHYSICAL_NAND_NUM * sizeof(STATE_RULE));
     memset(block_state, FREE_BLOCK, sizeof(STATE_RULE) * PHYSICAL_NAND_NUM);
+    block_owner = calloc(PHYSICAL_NAND_NUM, sizeof(unsigned char));
+    page_ref = calloc(PHYSICAL_NAND_NUM * PAGE_PER_BLOCK, sizeof(unsigned char));
+    nand_oob = calloc(PHYSICAL_NAND_NUM * PAGE_PER_BLOCK, sizeof(NAND_OOB));
+    crc32c_init();
+
+    //every block starts in the shared pool
+    pool_number = 1;
+    pools[SHARED_POOL].curr_pca.pca = INVALID_PCA;
+    pools[SHARED_POOL].gc_victim = OUT_OF_BLOCK;
+    pools[SHARED_POOL].free_block_number = PHYSICAL_NAND_NUM;
+    pools[SHARED_POOL].block_number = PHYSICAL_NAND_NUM;
+    pools[SHARED_POOL].capacity = 0;
+    pools[SHARED_POOL].pages_per_block = PAGE_PER_BLOCK;
+    pthread_mutex_init(&pools[SHARED_POOL].lock, NULL);
+    pools[SHARED_POOL].gc_buf = malloc(PAGESIZE * PAGE_PER_BLOCK);
+
+    options.queue_depth = NAND_QUEUE_DEPTH;
+    if (fuse_opt_parse(&args, &options, option_spec, NULL) == -1)
+    {
+        return 1;
+    }
+
+    if (options.slc && ssd_slc_create(options.slc) < 0)
+    {
+        printf("invalid SLC pool --slc=%u\n", options.slc);
+        return 1;
+    }
+
+    if (options.ns)
+    {
+        ret = ssd_ns_parse(options.ns);
+    }
+    else
+    {
+        ret = ssd_ns_create(NAND_SIZE_KB * 1024, 0);
+    }
+    if (ret < 0 && options.ns)
+    {
+        printf("invalid namespace layout --ns=%s\n", options.ns);
+        return 1;
+    }
+    if (ret < 0)
+    {
+        printf("SLC pool --slc=%u leaves too few blocks for the default %d KB namespace, "
+               "give a smaller one with --ns\n", options.slc, NAND_SIZE_KB);
+        return 1;
+    }
 
     //create nand file
     for (idx = 0; idx < PHYSICAL_NAND_NUM; idx++)
     {
-        FILE* fptr;
         snprintf(nand_name, 100, "%s/nand_%d", NAND_LOCATION, idx);
-        fptr = fopen(nand_name, "w");
-        if (fptr == NULL)
+        nand_fd[idx] = open(nand_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (nand_fd[idx] < 0)
         {
             printf("open fail");
+            return 1;
         }
-        fclose(fptr);
     }
-    return fuse_main(argc, argv, &ssd_oper, NULL);
-}
\ No newline at end of file
+
+#ifdef SSD_IO_URING
+    if (options.queue_depth == 0 ||
+        io_uring_queue_init(options.queue_depth, &ring, 0) < 0)
+    {
+        printf("io_uring init fail, queue depth %u\n", options.queue_depth);
+        return 1;
+    }
+#else
+    if (options.queue_depth == 0)
+    {
+        printf("queue depth must not be 0\n");
+        return 1;
+    }
+#endif
+    // Without io_uring a slot is one thread in a read or write system call
+    nand_cmd_number = options.queue_depth;
+    nand_cmds = calloc(nand_cmd_number, sizeof(NAND_CMD));
+    nand_cmd_free = calloc(nand_cmd_number, sizeof(NAND_CMD*));
+    nand_cmd_reset();
+
+    if (options.lowlevel)
+    {
+        ret = ssd_ll_main(&args);
+    }
+    else
+    {
+        ret = fuse_main(args.argc, args.argv, &ssd_oper, NULL);
+    }
+    fuse_opt_free_args(&args);
+    return ret;
+}
\ No newline at end of file
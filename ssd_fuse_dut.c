@@ -25,7 +25,27 @@ const char* usage =
     "  r SIZE [OFF] : read SIZE bytes @ OFF (dfl 0) and output to stdout\n"
     "  w SIZE [OFF] : write SIZE bytes @ OFF (dfl 0) from random\n"
     "  W    : write amplification factor\n"
+    "  g    : GC statistics\n"
+    "  S    : SLC cache statistics\n"
+    "  f LOW HIGH : fold the SLC cache from HIGH full blocks down to LOW\n"
+    "  n SIZE [BLOCKS] : create a namespace of SIZE bytes, with BLOCKS dedicated blocks (dfl 0, shared)\n"
+    "  s    : namespace statistics\n"
+    "  c    : take a snapshot, prints the snapshot file name\n"
+    "  d    : delete the snapshot SSD_FILE\n"
+    "  z    : zone report\n"
+    "  O IDX : open zone IDX\n"
+    "  C IDX : close zone IDX\n"
+    "  F IDX : finish zone IDX\n"
+    "  R IDX : reset zone IDX\n"
     "\n";
+const char* zone_state[] =
+{
+    [SSD_ZONE_EMPTY]    = "empty",
+    [SSD_ZONE_IMP_OPEN] = "implicit open",
+    [SSD_ZONE_EXP_OPEN] = "explicit open",
+    [SSD_ZONE_CLOSED]   = "closed",
+    [SSD_ZONE_FULL]     = "full",
+};
 static int do_rw(FILE* fd, int is_read, size_t size, off_t offset)
 {
     char* buf;
@@ -160,6 +180,190 @@ int main(int argc, char** argv)
             printf("%f\n", wa);
             close(fd);
             return 0;
+        case 'g':
+            fd = open(path, O_RDWR);
+            if (fd < 0)
+            {
+                perror("open");
+                return 1;
+            }
+            struct ssd_gc_stat gc;
+            if (ioctl(fd, SSD_GET_GC_STAT, &gc))
+            {
+                perror("ioctl");
+                goto error;
+            }
+            printf("copied: %zu pages, %.0f pages/s\n", gc.copied_pages,
+                   gc.time_ns ? gc.copied_pages * 1e9 / gc.time_ns : 0);
+            printf("erased: %zu blocks, %llu ns per block\n", gc.erased_blocks,
+                   gc.erased_blocks ? gc.time_ns / gc.erased_blocks : 0);
+            printf("lost: %zu pages\n", gc.lost_pages);
+            close(fd);
+            return 0;
+        case 'S':
+            fd = open(path, O_RDWR);
+            if (fd < 0)
+            {
+                perror("open");
+                return 1;
+            }
+            struct ssd_slc_stat slc;
+            if (ioctl(fd, SSD_GET_SLC_STAT, &slc))
+            {
+                perror("ioctl");
+                goto error;
+            }
+            printf("pool: %u blocks of %u pages, %u full\n", slc.blocks,
+                   slc.pages_per_block, slc.full_blocks);
+            printf("fold: from %u down to %u full blocks\n", slc.fold_high, slc.fold_low);
+            printf("host: %zu pages, %zu bypassed\n", slc.host_pages, slc.bypass_pages);
+            printf("folded: %zu pages in %zu programs\n", slc.fold_pages, slc.fold_programs);
+            close(fd);
+            return 0;
+        case 'f':
+            fd = open(path, O_RDWR);
+            if (fd < 0)
+            {
+                perror("open");
+                return 1;
+            }
+            struct ssd_slc_fold fold = { .fold_low = param[0], .fold_high = param[1] };
+            if (ioctl(fd, SSD_SET_FOLD, &fold))
+            {
+                perror("ioctl");
+                goto error;
+            }
+            close(fd);
+            return 0;
+        case 'n':
+            fd = open(path, O_RDWR);
+            if (fd < 0)
+            {
+                perror("open");
+                return 1;
+            }
+            struct ssd_ns_create create = { .size = param[0], .blocks = param[1] };
+            if (ioctl(fd, SSD_NS_CREATE, &create))
+            {
+                perror("ioctl");
+                goto error;
+            }
+            printf("%u\n", create.nsid);
+            close(fd);
+            return 0;
+        case 's':
+            fd = open(path, O_RDWR);
+            if (fd < 0)
+            {
+                perror("open");
+                return 1;
+            }
+            struct ssd_ns_stat stat;
+            if (ioctl(fd, SSD_GET_NS_STAT, &stat))
+            {
+                perror("ioctl");
+                goto error;
+            }
+            printf("size: %zu / %zu\n", stat.logic_size, stat.capacity);
+            printf("WA: %f\n", stat.host_write_size ?
+                   (double)stat.nand_write_size / (double)stat.host_write_size : 0);
+            printf("read: %zu, avg %llu ns, max %llu ns\n", stat.read_count,
+                   stat.read_count ? stat.read_lat_ns / stat.read_count : 0,
+                   stat.read_lat_max_ns);
+            printf("write: %zu, avg %llu ns, max %llu ns\n", stat.write_count,
+                   stat.write_count ? stat.write_lat_ns / stat.write_count : 0,
+                   stat.write_lat_max_ns);
+            for (int i = 0; i < SSD_LAT_HIST_NUM; i++)
+            {
+                if (stat.write_lat_hist[i])
+                {
+                    printf("  %s %6u us: %zu\n",
+                           i == SSD_LAT_HIST_NUM - 1 ? ">=" : "< ",
+                           1u << (i == SSD_LAT_HIST_NUM - 1 ? i - 1 : i),
+                           stat.write_lat_hist[i]);
+                }
+            }
+            printf("readahead: %zu pages, %zu hits\n", stat.readahead_pages,
+                   stat.readahead_hits);
+            close(fd);
+            return 0;
+        case 'c':
+            fd = open(path, O_RDWR);
+            if (fd < 0)
+            {
+                perror("open");
+                return 1;
+            }
+            struct ssd_snapshot snap;
+            // Writes the kernel still caches must reach the namespace first
+            if (fsync(fd))
+            {
+                perror("fsync");
+                goto error;
+            }
+            if (ioctl(fd, SSD_SNAPSHOT_CREATE, &snap))
+            {
+                perror("ioctl");
+                goto error;
+            }
+            printf("%s\n", snap.name);
+            close(fd);
+            return 0;
+        case 'd':
+            fd = open(path, O_RDONLY);
+            if (fd < 0)
+            {
+                perror("open");
+                return 1;
+            }
+            if (ioctl(fd, SSD_SNAPSHOT_DELETE))
+            {
+                perror("ioctl");
+                goto error;
+            }
+            close(fd);
+            return 0;
+        case 'z':
+            fd = open(path, O_RDWR);
+            if (fd < 0)
+            {
+                perror("open");
+                return 1;
+            }
+            struct ssd_zone_report report;
+            if (ioctl(fd, SSD_ZONE_REPORT, &report))
+            {
+                perror("ioctl");
+                goto error;
+            }
+            for (i = 0; i < report.nr_zones; i++)
+            {
+                printf("zone %d: start %zu, wp %zu, state %s\n", i,
+                       report.zones[i].start, report.zones[i].wp,
+                       zone_state[report.zones[i].state]);
+            }
+            close(fd);
+            return 0;
+        case 'O':
+        case 'C':
+        case 'F':
+        case 'R':
+            fd = open(path, O_RDWR);
+            if (fd < 0)
+            {
+                perror("open");
+                return 1;
+            }
+            unsigned int zone = param[0];
+            if (ioctl(fd, cmd == 'O' ? SSD_ZONE_OPEN :
+                      cmd == 'C' ? SSD_ZONE_CLOSE :
+                      cmd == 'F' ? SSD_ZONE_FINISH : SSD_ZONE_RESET, &zone))
+            {
+                perror("ioctl");
+                goto error;
+            }
+            close(fd);
+            return 0;
     }
 usage:
     fprintf(stderr, "%s", usage);
@@ -167,4 +371,4 @@ usage:
 error:
 
     return 1;
-}
\ No newline at end of file
+}
\ No newline at end of file
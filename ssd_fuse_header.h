@@ -16,12 +16,122 @@
 #define FREE_BLOCK     (0xFFFFFFFF)
 #define OUT_OF_BLOCK     (0xFFFF)
 #define FULL_PCA     (0xFFFFFFFE)
+#define BAD_PCA     (0xFFFFFFFD)
 #define PAGE_PER_BLOCK     (10)
 #define NAND_LOCATION  "/tmp/ssd_fuse"
+#define MAX_NS_NUM     (16)
+#define SSD_MAX_ZONES  PHYSICAL_NAND_NUM
+#define SSD_LAT_HIST_NUM (16)
+
+enum
+{
+    SSD_ZONE_EMPTY,
+    SSD_ZONE_IMP_OPEN,
+    SSD_ZONE_EXP_OPEN,
+    SSD_ZONE_CLOSED,
+    SSD_ZONE_FULL,
+};
+
+// Offsets are in bytes from the start of the namespace file
+struct ssd_zone
+{
+    size_t start;
+    size_t wp;
+    unsigned int state;
+};
+
+struct ssd_zone_report
+{
+    unsigned int nr_zones;
+    unsigned int zone_size;
+    struct ssd_zone zones[SSD_MAX_ZONES];
+};
+
+// SSD_NS_CREATE argument, blocks == 0 means the namespace shares the common block pool
+struct ssd_ns_create
+{
+    size_t size;
+    unsigned int blocks;
+    unsigned int nsid;
+};
+
+// SSD_SNAPSHOT_CREATE result, the snapshot is exposed as file name
+struct ssd_snapshot
+{
+    unsigned int nsid;
+    char name[32];
+};
+
+// Per-namespace counters, latency in nanoseconds.
+// write_lat_hist[i] counts writes under 2^i us, the last bucket the rest.
+struct ssd_ns_stat
+{
+    size_t logic_size;
+    size_t capacity;
+    size_t host_write_size;
+    size_t nand_write_size;
+    size_t read_count;
+    size_t write_count;
+    unsigned long long read_lat_ns;
+    unsigned long long read_lat_max_ns;
+    unsigned long long write_lat_ns;
+    unsigned long long write_lat_max_ns;
+    size_t readahead_pages;
+    size_t readahead_hits;
+    size_t write_lat_hist[SSD_LAT_HIST_NUM];
+};
+
+// SSD_GET_GC_STAT result, time spent in GC in nanoseconds.
+// lost_pages counts the pages GC or folding could not read back.
+struct ssd_gc_stat
+{
+    size_t copied_pages;
+    size_t erased_blocks;
+    size_t lost_pages;
+    unsigned long long time_ns;
+};
+
+// SSD_GET_SLC_STAT result. The SLC pool has blocks blocks of
+// pages_per_block pages, full_blocks of them wait for folding.
+// host_pages counts host pages written there, bypass_pages those that
+// found it full, fold_pages the pages folding moved to dense blocks in
+// fold_programs programs.
+struct ssd_slc_stat
+{
+    unsigned int blocks;
+    unsigned int pages_per_block;
+    unsigned int full_blocks;
+    unsigned int fold_low;
+    unsigned int fold_high;
+    size_t host_pages;
+    size_t bypass_pages;
+    size_t fold_pages;
+    size_t fold_programs;
+};
+
+// SSD_SET_FOLD argument, in full SLC blocks. Folding starts at
+// fold_high, or once the host goes idle, and stops at fold_low.
+struct ssd_slc_fold
+{
+    unsigned int fold_low;
+    unsigned int fold_high;
+};
 
 enum
 {
     SSD_GET_LOGIC_SIZE   = _IOR('E', 0, size_t),
     SSD_GET_PHYSIC_SIZE   = _IOR('E', 1, size_t),
     SSD_GET_WA            = _IOR('E', 2, size_t),
+    SSD_NS_CREATE         = _IOWR('E', 3, struct ssd_ns_create),
+    SSD_GET_NS_STAT       = _IOR('E', 4, struct ssd_ns_stat),
+    SSD_SNAPSHOT_CREATE   = _IOR('E', 5, struct ssd_snapshot),
+    SSD_SNAPSHOT_DELETE   = _IO('E', 6),
+    SSD_ZONE_REPORT       = _IOR('E', 7, struct ssd_zone_report),
+    SSD_ZONE_OPEN         = _IOW('E', 8, unsigned int),
+    SSD_ZONE_CLOSE        = _IOW('E', 9, unsigned int),
+    SSD_ZONE_FINISH       = _IOW('E', 10, unsigned int),
+    SSD_ZONE_RESET        = _IOW('E', 11, unsigned int),
+    SSD_GET_GC_STAT       = _IOR('E', 12, struct ssd_gc_stat),
+    SSD_GET_SLC_STAT      = _IOR('E', 13, struct ssd_slc_stat),
+    SSD_SET_FOLD          = _IOW('E', 14, struct ssd_slc_fold),
 };
@@ -1,8 +1,12 @@
 #!/bin/bash
 
 SSD_FILE="/tmp/ssd/ssd_file"
+SSD_FILE1="/tmp/ssd/ssd_file1"
 GOLDEN="/tmp/ssd_file_golden"
+GOLDEN1="/tmp/ssd_file1_golden"
+SNAP_GOLDEN="/tmp/ssd_file_snap_golden"
 TEMP="/tmp/temp"
+FAIL=0
 touch ${GOLDEN}
 truncate -s 0 ${SSD_FILE}
 truncate -s 0 ${GOLDEN}
@@ -29,6 +33,52 @@ case "$1" in
         dd if=${TEMP} iflag=skip_bytes skip=10240 of=${GOLDEN} oflag=seek_bytes seek=0 bs=1024 count=1 conv=notrunc 2> /dev/null
         dd if=${TEMP} iflag=skip_bytes skip=10240 of=${SSD_FILE} oflag=seek_bytes seek=0 bs=1024 count=1 conv=notrunc 2> /dev/null
         ;;
+    "test3")
+        truncate -s 0 ${SSD_FILE1}
+        cat /dev/urandom | tr -dc '[:alpha:][:digit:]' | head -c 20480 | tee ${SSD_FILE} > ${GOLDEN} 2> /dev/null
+        cat /dev/urandom | tr -dc '[:alpha:][:digit:]' | head -c 20480 | tee ${SSD_FILE1} > ${GOLDEN1} 2> /dev/null
+        cat /dev/urandom | tr -dc '[:alpha:][:digit:]' | head -c 30720 > ${TEMP}
+        for i in $(seq 0 29)
+        do
+            dd if=${TEMP} iflag=skip_bytes skip=$(($i*1024)) of=${GOLDEN1} oflag=seek_bytes seek=$((($i%10)*2048+($i/10)*512)) bs=1024 count=1 conv=notrunc 2> /dev/null
+            dd if=${TEMP} iflag=skip_bytes skip=$(($i*1024)) of=${SSD_FILE1} oflag=seek_bytes seek=$((($i%10)*2048+($i/10)*512)) bs=1024 count=1 conv=notrunc 2> /dev/null
+        done
+        diff ${GOLDEN1} ${SSD_FILE1} || FAIL=1
+        ;;
+    "test4")
+        cat /dev/urandom | tr -dc '[:alpha:][:digit:]' | head -c 20480 | tee ${SSD_FILE} > ${GOLDEN} 2> /dev/null
+        cp ${GOLDEN} ${SNAP_GOLDEN}
+        SNAP=/tmp/ssd/$(./ssd_fuse_dut ${SSD_FILE} c)
+        cat /dev/urandom | tr -dc '[:alpha:][:digit:]' | head -c 10240 > ${TEMP}
+        for i in $(seq 0 9)
+        do
+            dd if=${TEMP} iflag=skip_bytes skip=$(($i*1024)) of=${GOLDEN} oflag=seek_bytes seek=$(($i*2048)) bs=1024 count=1 conv=notrunc 2> /dev/null
+            dd if=${TEMP} iflag=skip_bytes skip=$(($i*1024)) of=${SSD_FILE} oflag=seek_bytes seek=$(($i*2048)) bs=1024 count=1 conv=notrunc 2> /dev/null
+        done
+        diff ${SNAP_GOLDEN} ${SNAP} || FAIL=1
+        ./ssd_fuse_dut ${SNAP} d || FAIL=1
+        ;;
+    "test5")
+        head -c 51200 /dev/zero > ${GOLDEN}
+        cat /dev/urandom | tr -dc '[:alpha:][:digit:]' | head -c 10240 > ${TEMP}
+        for i in $(seq 0 4)
+        do
+            dd if=${TEMP} iflag=skip_bytes skip=$(($i*1024)) of=${GOLDEN} oflag=seek_bytes seek=$(($i*1024)) bs=1024 count=1 conv=notrunc 2> /dev/null
+            dd if=${TEMP} iflag=skip_bytes skip=$(($i*1024)) of=${SSD_FILE} oflag=seek_bytes seek=$(($i*1024)) bs=1024 count=1 conv=notrunc 2> /dev/null
+        done
+        # not at the write pointer of zone 1
+        dd if=${TEMP} of=${SSD_FILE} oflag=seek_bytes seek=6144 bs=1024 count=1 conv=notrunc 2> /dev/null && FAIL=1
+        dd if=${TEMP} iflag=skip_bytes skip=5120 of=${GOLDEN} oflag=seek_bytes seek=10240 bs=4096 count=1 conv=notrunc 2> /dev/null
+        dd if=${TEMP} iflag=skip_bytes skip=5120 of=${SSD_FILE} oflag=seek_bytes seek=10240 bs=4096 count=1 conv=notrunc 2> /dev/null
+        # crosses from zone 2 into zone 3
+        dd if=${TEMP} of=${SSD_FILE} oflag=seek_bytes seek=14336 bs=2048 count=1 conv=notrunc 2> /dev/null && FAIL=1
+        dd if=${TEMP} iflag=skip_bytes skip=9216 of=${GOLDEN} oflag=seek_bytes seek=15360 bs=700 count=1 conv=notrunc 2> /dev/null
+        dd if=${TEMP} iflag=skip_bytes skip=9216 of=${SSD_FILE} oflag=seek_bytes seek=15360 bs=700 count=1 conv=notrunc 2> /dev/null
+        ./ssd_fuse_dut ${SSD_FILE} R 0 || FAIL=1
+        dd if=/dev/zero of=${GOLDEN} bs=5120 count=1 conv=notrunc 2> /dev/null
+        dd if=${TEMP} iflag=skip_bytes skip=8192 of=${GOLDEN} bs=2048 count=1 conv=notrunc 2> /dev/null
+        dd if=${TEMP} iflag=skip_bytes skip=8192 of=${SSD_FILE} bs=2048 count=1 conv=notrunc 2> /dev/null
+        ;;
     *)
         printf "Usage: sh test.sh test_pattern\n"
         printf "\n"
@@ -40,13 +90,29 @@ case "$1" in
         printf "       2: Override 0, 1, 10, 11, 20, 21, 30, 31, 40, 41, 50, 51, 60, 61, 70, 71, 80, 81, 90, 91 page \n"
         printf "       2: Override 0, 1 page \n"
         printf "       test GC's result\n"
+        printf "test3: Mount with --ns=20,20\n"
+        printf "       1: Sequential write ssd_file and ssd_file1 (20480bytes each)\n"
+        printf "       2: Override 60 pages of ssd_file1\n"
+        printf "       test namespace isolation, GC of the shared pool moves pages of both\n"
+        printf "test4:\n"
+        printf "       1: Sequential write 20480bytes and take a snapshot\n"
+        printf "       2: Override 0, 1, 4, 5, 8, 9, ..., 36, 37 page \n"
+        printf "       3: Delete the snapshot\n"
+        printf "       test the snapshot keeps the data it was taken with\n"
+        printf "test5: (mount with --zoned)\n"
+        printf "       1: Sequential write zone 0, 1024bytes at a time\n"
+        printf "       2: Write zone 1 past its write pointer, must fail\n"
+        printf "       3: Write 4096bytes to zone 2, then 2048bytes across zone 3, must fail\n"
+        printf "       4: Write 700bytes to zone 3, padded with zeros\n"
+        printf "       5: Reset zone 0 and write 2048bytes to it\n"
+        printf "       test the write pointer rules and zone reset\n"
         return 
         ;;
 esac
 
 # check
 diff ${GOLDEN} ${SSD_FILE}
-if [ $? -eq 0 ]
+if [ $? -eq 0 ] && [ ${FAIL} -eq 0 ]
 then
     echo "success!"
 else
@@ -55,4 +121,4 @@ fi
 
 echo "WA:"
 ./ssd_fuse_dut /tmp/ssd/ssd_file W
-rm -rf ${TEMP} ${GOLDEN}
\ No newline at end of file
+rm -rf ${TEMP} ${GOLDEN} ${GOLDEN1} ${SNAP_GOLDEN}
\ No newline at end of file